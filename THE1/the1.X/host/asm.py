@@ -0,0 +1,156 @@
+"""
+Assembles main.s to the program memory image pic-as would link it to, and
+writes it as Intel hex for the emulator in emu.c. Instructions are laid out
+and their operands resolved by pic18.py, this only encodes them. File
+operands in the access bank (below 60h or from F60h) use the access bank,
+the others are banked. CONFIG words are left out, the emulator does not
+read them.
+
+Usage: asm.py [-o out.hex] main.s
+"""
+
+import argparse
+import sys
+
+import pic18
+
+# Opcodes with the operand fields clear
+FILE_OP = {
+    "addwf": 0x2400, "addwfc": 0x2000, "andwf": 0x1400, "comf": 0x1C00,
+    "decf": 0x0400, "decfsz": 0x2C00, "dcfsnz": 0x4C00, "incf": 0x2800,
+    "incfsz": 0x3C00, "infsnz": 0x4800, "iorwf": 0x1000, "movf": 0x5000,
+    "rlcf": 0x3400, "rlncf": 0x4400, "rrcf": 0x3000, "rrncf": 0x4000,
+    "subfwb": 0x5400, "subwf": 0x5C00, "subwfb": 0x5800, "swapf": 0x3800,
+    "xorwf": 0x1800,
+    "clrf": 0x6A00, "cpfseq": 0x6200, "cpfsgt": 0x6400, "cpfslt": 0x6000,
+    "movwf": 0x6E00, "mulwf": 0x0200, "negf": 0x6C00, "setf": 0x6800,
+    "tstfsz": 0x6600,
+}
+BIT_OP = {"bsf": 0x8000, "bcf": 0x9000, "btfss": 0xA000, "btfsc": 0xB000,
+          "btg": 0x7000}
+LITERAL_OP = {"addlw": 0x0F00, "andlw": 0x0B00, "iorlw": 0x0900,
+              "movlb": 0x0100, "movlw": 0x0E00, "mullw": 0x0D00,
+              "retlw": 0x0C00, "sublw": 0x0800, "xorlw": 0x0A00}
+BRANCH_OP = {"bz": 0xE000, "bnz": 0xE100, "bc": 0xE200, "bnc": 0xE300,
+             "bov": 0xE400, "bnov": 0xE500, "bn": 0xE600, "bnn": 0xE700}
+INHERENT_OP = {"nop": 0x0000, "sleep": 0x0003, "clrwdt": 0x0004,
+               "push": 0x0005, "pop": 0x0006, "daw": 0x0007, "reset": 0x00FF,
+               "tblrd*": 0x0008, "tblrd*+": 0x0009, "tblrd*-": 0x000A,
+               "tblrd+*": 0x000B, "tblwt*": 0x000C, "tblwt*+": 0x000D,
+               "tblwt*-": 0x000E, "tblwt+*": 0x000F}
+
+
+def _access(f):
+    """The a bit and the 8-bit f field of a file address"""
+    if f < 0x60 or f >= 0xF60:
+        return 0, f & 0xFF
+    return 1, f & 0xFF
+
+
+def _offset(prog, insn, bits):
+    n = (prog.insns[insn.target].addr - insn.addr - 2) // 2
+    if not -(1 << (bits - 1)) <= n < 1 << (bits - 1):
+        raise pic18.AsmError("%d: %s: branch out of range" % (insn.line, insn.text))
+    return n & ((1 << bits) - 1)
+
+
+def encode(prog, insn):
+    """The program words of one instruction"""
+    m = insn.mnem
+    if m in FILE_OP:
+        a, f = _access(insn.f)
+        d = insn.d if insn.d is not None else 0
+        return [FILE_OP[m] | d << 9 | a << 8 | f]
+    if m in BIT_OP:
+        a, f = _access(insn.f)
+        return [BIT_OP[m] | (insn.b & 7) << 9 | a << 8 | f]
+    if m in LITERAL_OP:
+        return [LITERAL_OP[m] | (insn.k & (0x0F if m == "movlb" else 0xFF))]
+    if m in BRANCH_OP:
+        return [BRANCH_OP[m] | _offset(prog, insn, 8)]
+    if m == "bra":
+        return [0xD000 | _offset(prog, insn, 11)]
+    if m == "rcall":
+        return [0xD800 | _offset(prog, insn, 11)]
+    if m in ("goto", "call"):
+        k = prog.insns[insn.target].addr >> 1
+        op = 0xEF00 if m == "goto" else 0xEC00 | (insn.fast & 1) << 8
+        return [op | (k & 0xFF), 0xF000 | (k >> 8) & 0xFFF]
+    if m == "return":
+        return [0x0012 | (insn.fast & 1)]
+    if m == "retfie":
+        return [0x0010 | (insn.fast & 1)]
+    if m == "lfsr":
+        return [0xEE00 | (insn.f & 3) << 4 | insn.k >> 8, 0xF000 | (insn.k & 0xFF)]
+    if m == "movff":
+        return [0xC000 | insn.f & 0xFFF, 0xF000 | insn.f2 & 0xFFF]
+    if m in INHERENT_OP:
+        return [INHERENT_OP[m]]
+    raise pic18.AsmError("%d: %s: cannot encode" % (insn.line, insn.text))
+
+
+def assemble(prog):
+    """{byte address: program word}"""
+    image = {}
+    for insn in prog.insns:
+        try:
+            words = encode(prog, insn)
+        except TypeError:
+            # An operand pic18.read could not evaluate is None
+            raise pic18.AsmError("%d: %s: unresolved operand" % (insn.line, insn.text))
+        for n, word in enumerate(words):
+            image[insn.addr + 2 * n] = word
+    return image
+
+
+def _record(addr, rtype, data):
+    body = [len(data), addr >> 8 & 0xFF, addr & 0xFF, rtype] + list(data)
+    return ":" + "".join("%02X" % b for b in body) + "%02X" % (-sum(body) & 0xFF)
+
+
+def intel_hex(image):
+    """Intel hex lines of the image, 16 data bytes a record"""
+    data = {}
+    for addr, word in image.items():
+        data[addr] = word & 0xFF
+        data[addr + 1] = word >> 8
+    lines = []
+    upper = 0
+    addrs = sorted(data)
+    i = 0
+    while i < len(addrs):
+        start = addrs[i]
+        if start >> 16 != upper:
+            upper = start >> 16
+            lines.append(_record(0, 4, [upper >> 8, upper & 0xFF]))
+        chunk = [data[start]]
+        i += 1
+        while (i < len(addrs) and addrs[i] == start + len(chunk) and len(chunk) < 16
+               and addrs[i] >> 16 == upper):
+            chunk.append(data[addrs[i]])
+            i += 1
+        lines.append(_record(start & 0xFFFF, 0, chunk))
+    lines.append(_record(0, 1, []))
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.strip().split("\n\n")[0])
+    ap.add_argument("-o", metavar="out.hex", help="output file (default stdout)")
+    ap.add_argument("source")
+    args = ap.parse_args()
+    try:
+        text = intel_hex(assemble(pic18.read(args.source)))
+    except pic18.AsmError as e:
+        print("asm: %s" % e, file=sys.stderr)
+        return 1
+    if args.o:
+        with open(args.o, "w") as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,1196 @@
+/*
+ * File:   emu.c
+ *
+ * PIC18F8722 instruction set emulator for the THE1 tests, built as a shared
+ * library that ../tests/emu.py drives in place of the MPLAB mdb simulator.
+ * It loads an Intel hex program image and runs it one instruction at a
+ * time, counting instruction cycles.
+ *
+ * Modelled: the whole legacy instruction set (no extended instructions),
+ * access and banked RAM, indirect addressing through FSR0-2, the hardware
+ * stack and the fast register stack, table reads, PORTx/LATx/TRISx of ports
+ * A to J, Timer0 in 8 and 16-bit mode with its prescaler and the Timer0
+ * interrupt, at either priority. The other peripherals are plain RAM.
+ *
+ * Timer0 counts at the start of every instruction cycle, an instruction
+ * reads its operand after that and writes its result at the end of its
+ * cycle. A write to TMR0L stops the count for the next two cycles, as the
+ * datasheet says.
+ *
+ * The caller watches data addresses: emu_run returns after an instruction
+ * that wrote one of them, the way a data breakpoint stops mdb.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROG_BYTES (128 * 1024)
+#define DATA_SIZE  4096
+#define STACK_SIZE 31
+
+/* **** Registers **** */
+#define PORTA   0xF80
+#define LATA    0xF89
+#define TRISA   0xF92
+#define N_PORTS 9
+#define RCON    0xFD0
+#define T0CON   0xFD5
+#define TMR0L   0xFD6
+#define TMR0H   0xFD7
+#define STATUS  0xFD8
+#define FSR2L   0xFD9
+#define INDF2   0xFDF
+#define BSR     0xFE0
+#define FSR1L   0xFE1
+#define INDF1   0xFE7
+#define WREG    0xFE8
+#define FSR0L   0xFE9
+#define INDF0   0xFEF
+#define INTCON2 0xFF1
+#define INTCON  0xFF2
+#define PRODL   0xFF3
+#define PRODH   0xFF4
+#define TABLAT  0xFF5
+#define TBLPTRL 0xFF6
+#define TBLPTRH 0xFF7
+#define TBLPTRU 0xFF8
+#define PCL     0xFF9
+#define PCLATH  0xFFA
+#define PCLATU  0xFFB
+#define STKPTR  0xFFC
+#define TOSL    0xFFD
+#define TOSH    0xFFE
+#define TOSU    0xFFF
+
+/* STATUS bits */
+#define C_BIT  0x01
+#define DC_BIT 0x02
+#define Z_BIT  0x04
+#define OV_BIT 0x08
+#define N_BIT  0x10
+
+/* INTCON bits */
+#define GIEH    0x80
+#define GIEL    0x40
+#define TMR0IE  0x20
+#define TMR0IF  0x04
+#define TMR0IP  0x04 // of INTCON2
+#define IPEN    0x80 // of RCON
+
+/* T0CON bits */
+#define TMR0ON 0x80
+#define T08BIT 0x40
+#define T0CS   0x20
+#define PSA    0x08
+
+/* Where the interrupts go */
+#define HIGH_VECTOR 0x08
+#define LOW_VECTOR  0x18
+/* Cycles from the instruction boundary to running the vector */
+#define INT_LATENCY 3
+
+typedef struct emu {
+    uint8_t prog[PROG_BYTES];
+    uint8_t ram[DATA_SIZE]; // W, STATUS, BSR and the other SFRs included
+    uint8_t watch[DATA_SIZE];
+    uint8_t pins[N_PORTS];  // levels driven on the input pins
+
+    uint32_t pc; // byte address
+    uint32_t stack[STACK_SIZE];
+    uint8_t sp; // entries on the stack
+    uint8_t ws, statuss, bsrs; // fast register stack
+
+    uint16_t tmr0;
+    uint8_t tmr0h_buf; // TMR0H as the CPU sees it in 16-bit mode
+    uint16_t prescale; // cycles counted towards the next prescaled tick
+    uint8_t inhibit;   // cycles the count is still stopped for
+    uint8_t in_high;   // in the high priority ISR, for retfie
+
+    uint64_t cycles;
+    int hit;    // the current instruction wrote a watched address
+    int halted; // an illegal instruction ran
+    char error[128];
+} emu_t;
+
+/* **** Timer0 **** */
+/* n instruction cycles pass, Timer0 counts them */
+static void tick(emu_t* e, unsigned n)
+{
+    uint8_t con = e->ram[T0CON];
+
+    e->cycles += n;
+    if (!(con & TMR0ON) || (con & T0CS))
+    {
+        return; // stopped, or counting the T0CKI pin nobody drives
+    }
+    if (e->inhibit)
+    {
+        unsigned k = n < e->inhibit ? n : e->inhibit;
+        e->inhibit = (uint8_t) (e->inhibit - k);
+        n -= k;
+    }
+    if (!(con & PSA))
+    {
+        unsigned div = 2u << (con & 7);
+        e->prescale = (uint16_t) (e->prescale + n);
+        n = e->prescale / div;
+        e->prescale = (uint16_t) (e->prescale % div);
+    }
+    if (n == 0)
+    {
+        return;
+    }
+    if (con & T08BIT)
+    {
+        unsigned low = (e->tmr0 & 0xFFu) + n;
+        if (low > 0xFF)
+        {
+            e->ram[INTCON] |= TMR0IF;
+        }
+        e->tmr0 = (uint16_t) ((e->tmr0 & 0xFF00) | (low & 0xFF));
+    }
+    else
+    {
+        uint32_t t = e->tmr0 + n;
+        if (t > 0xFFFF)
+        {
+            e->ram[INTCON] |= TMR0IF;
+        }
+        e->tmr0 = (uint16_t) t;
+    }
+}
+
+/* **** Data memory **** */
+static uint32_t tos(const emu_t* e)
+{
+    return e->sp ? e->stack[e->sp - 1] : 0;
+}
+
+static int is_indirect(uint16_t a)
+{
+    return (a >= 0xFDB && a <= INDF2) || (a >= 0xFE3 && a <= INDF1) || (a >= 0xFEB && a <= INDF0);
+}
+
+/*
+ * An indirect register only gets here when an FSR points at it, then it
+ * reads as 0 and writes do nothing
+ */
+static uint8_t rd(emu_t* e, uint16_t a)
+{
+    if (is_indirect(a))
+    {
+        return 0;
+    }
+    if (a >= PORTA && a < PORTA + N_PORTS)
+    {
+        int p = a - PORTA;
+        uint8_t tris = e->ram[TRISA + p];
+        return (uint8_t) ((e->ram[LATA + p] & ~tris) | (e->pins[p] & tris));
+    }
+    switch (a)
+    {
+    case TMR0L:
+        e->tmr0h_buf = (uint8_t) (e->tmr0 >> 8);
+        return (uint8_t) e->tmr0;
+    case TMR0H:
+        return e->tmr0h_buf;
+    case PCL:
+        e->ram[PCLATH] = (uint8_t) (e->pc >> 8);
+        e->ram[PCLATU] = (uint8_t) (e->pc >> 16);
+        return (uint8_t) e->pc;
+    case STKPTR:
+        return e->sp;
+    case TOSL:
+        return (uint8_t) tos(e);
+    case TOSH:
+        return (uint8_t) (tos(e) >> 8);
+    case TOSU:
+        return (uint8_t) (tos(e) >> 16);
+    default:
+        return e->ram[a];
+    }
+}
+
+static void wr(emu_t* e, uint16_t a, uint8_t v)
+{
+    if (e->watch[a])
+    {
+        e->hit = 1;
+    }
+    if (is_indirect(a))
+    {
+        return;
+    }
+    if (a >= PORTA && a < PORTA + N_PORTS)
+    {
+        e->ram[LATA + (a - PORTA)] = v;
+        return;
+    }
+    switch (a)
+    {
+    case TMR0L:
+        if (e->ram[T0CON] & T08BIT)
+        {
+            e->tmr0 = (uint16_t) ((e->tmr0 & 0xFF00) | v);
+        }
+        else
+        {
+            e->tmr0 = (uint16_t) (e->tmr0h_buf << 8 | v);
+        }
+        e->prescale = 0;
+        e->inhibit = 2;
+        return;
+    case TMR0H:
+        e->tmr0h_buf = v;
+        return;
+    case STATUS:
+        e->ram[a] = v & 0x1F;
+        return;
+    case BSR:
+        e->ram[a] = v & 0x0F;
+        return;
+    case PCL:
+        e->pc = (uint32_t) e->ram[PCLATU] << 16 | (uint32_t) e->ram[PCLATH] << 8 | v;
+        e->pc &= (PROG_BYTES - 1) & ~1u;
+        return;
+    case STKPTR:
+        e->sp = v & 0x1F;
+        if (e->sp > STACK_SIZE)
+        {
+            e->sp = STACK_SIZE;
+        }
+        return;
+    case TOSL:
+    case TOSH:
+    case TOSU:
+        if (e->sp)
+        {
+            int shift = (a - TOSL) * 8;
+            uint32_t* t = &e->stack[e->sp - 1];
+            *t = (*t & ~(0xFFu << shift)) | (uint32_t) v << shift;
+        }
+        return;
+    default:
+        e->ram[a] = v;
+    }
+}
+
+/*
+ * The address an operand names: INDFn and the other indirect registers
+ * are replaced by the FSRn address, adjusting FSRn as they say. Called
+ * once per operand, so a read-modify-write moves FSRn once.
+ */
+static uint16_t indirect(emu_t* e, uint16_t a)
+{
+    static const uint16_t fsr[3] = {FSR0L, FSR1L, FSR2L};
+    static const uint16_t indf[3] = {INDF0, INDF1, INDF2};
+
+    if (!is_indirect(a))
+    {
+        return a;
+    }
+    int n = a >= 0xFEB ? 0 : a >= 0xFE3 ? 1 : 2;
+    uint8_t* lo = &e->ram[fsr[n]];
+    uint16_t ptr = (uint16_t) ((lo[0] | lo[1] << 8) & 0xFFF);
+    uint16_t next = ptr;
+    uint16_t target = ptr;
+
+    switch (indf[n] - a)
+    {
+    case 0: // INDF
+        break;
+    case 1: // POSTINC
+        next = ptr + 1;
+        break;
+    case 2: // POSTDEC
+        next = ptr - 1;
+        break;
+    case 3: // PREINC
+        target = next = ptr + 1;
+        break;
+    default: // PLUSW
+        target = (uint16_t) (ptr + (int8_t) e->ram[WREG]);
+        break;
+    }
+    next &= 0xFFF;
+    lo[0] = (uint8_t) next;
+    lo[1] = (uint8_t) (next >> 8);
+    return target & 0xFFF;
+}
+
+/* Address of the f operand of a one-word instruction, a = 1 takes BSR */
+static uint16_t file_addr(emu_t* e, uint16_t op)
+{
+    uint16_t f = op & 0xFF;
+    uint16_t a;
+    if (op & 0x100)
+    {
+        a = (uint16_t) (e->ram[BSR] << 8 | f);
+    }
+    else
+    {
+        a = f < 0x60 ? f : (uint16_t) (0xF00 | f);
+    }
+    return indirect(e, a);
+}
+
+/* **** ALU **** */
+static void set_zn(emu_t* e, uint8_t r)
+{
+    uint8_t s = e->ram[STATUS] & ~(Z_BIT | N_BIT);
+    if (r == 0)
+    {
+        s |= Z_BIT;
+    }
+    if (r & 0x80)
+    {
+        s |= N_BIT;
+    }
+    e->ram[STATUS] = s;
+}
+
+/* a + b + c, with every STATUS flag */
+static uint8_t add(emu_t* e, uint8_t a, uint8_t b, int c)
+{
+    unsigned r = (unsigned) a + b + (unsigned) c;
+    uint8_t s = e->ram[STATUS] & ~(C_BIT | DC_BIT | OV_BIT);
+    if (r > 0xFF)
+    {
+        s |= C_BIT;
+    }
+    if ((a & 0x0F) + (b & 0x0F) + c > 0x0F)
+    {
+        s |= DC_BIT;
+    }
+    if (~(a ^ b) & (a ^ r) & 0x80)
+    {
+        s |= OV_BIT;
+    }
+    e->ram[STATUS] = s;
+    set_zn(e, (uint8_t) r);
+    return (uint8_t) r;
+}
+
+/* a - b, borrowing when c is 0, C is set when nothing was borrowed */
+static uint8_t sub(emu_t* e, uint8_t a, uint8_t b, int c)
+{
+    return add(e, a, (uint8_t) ~b, c);
+}
+
+static int carry(const emu_t* e)
+{
+    return e->ram[STATUS] & C_BIT;
+}
+
+/* **** Control **** */
+static void push(emu_t* e, uint32_t addr)
+{
+    if (e->sp < STACK_SIZE)
+    {
+        e->stack[e->sp++] = addr;
+    }
+}
+
+static uint32_t pop(emu_t* e)
+{
+    return e->sp ? e->stack[--e->sp] : 0;
+}
+
+static void save_fast(emu_t* e)
+{
+    e->ws = e->ram[WREG];
+    e->statuss = e->ram[STATUS];
+    e->bsrs = e->ram[BSR];
+}
+
+static void restore_fast(emu_t* e)
+{
+    e->ram[WREG] = e->ws;
+    e->ram[STATUS] = e->statuss;
+    e->ram[BSR] = e->bsrs;
+}
+
+static uint16_t fetch(const emu_t* e, uint32_t addr)
+{
+    addr &= PROG_BYTES - 1;
+    return (uint16_t) (e->prog[addr] | e->prog[addr + 1] << 8);
+}
+
+/* Vectors to the ISR of a pending Timer0 interrupt, returns 1 if it did */
+static int interrupt(emu_t* e)
+{
+    uint8_t intcon = e->ram[INTCON];
+    if (!(intcon & TMR0IE) || !(intcon & TMR0IF))
+    {
+        return 0;
+    }
+
+    uint32_t vector = HIGH_VECTOR;
+    if (!(e->ram[RCON] & IPEN))
+    {
+        if (!(intcon & GIEH))
+        {
+            return 0;
+        }
+        e->ram[INTCON] &= ~GIEH;
+    }
+    else if (e->ram[INTCON2] & TMR0IP)
+    {
+        if (!(intcon & GIEH))
+        {
+            return 0;
+        }
+        e->ram[INTCON] &= ~GIEH;
+        e->in_high = 1;
+    }
+    else
+    {
+        if (!(intcon & GIEH) || !(intcon & GIEL) || e->in_high)
+        {
+            return 0;
+        }
+        e->ram[INTCON] &= ~GIEL;
+        vector = LOW_VECTOR;
+    }
+    push(e, e->pc);
+    save_fast(e);
+    e->pc = vector;
+    tick(e, INT_LATENCY);
+    return 1;
+}
+
+static void retfie(emu_t* e)
+{
+    if (!(e->ram[RCON] & IPEN) || e->in_high)
+    {
+        e->ram[INTCON] |= GIEH;
+        e->in_high = 0;
+    }
+    else
+    {
+        e->ram[INTCON] |= GIEL;
+    }
+}
+
+static void illegal(emu_t* e, uint32_t pc, uint16_t op)
+{
+    snprintf(e->error, sizeof(e->error), "illegal instruction %04X at %05X", op, (unsigned) pc);
+    e->halted = 1;
+}
+
+/* **** Instructions **** */
+/* Executes the instruction at pc, returns its cycles after the first one */
+static int step(emu_t* e)
+{
+    uint32_t pc = e->pc;
+    uint16_t op = fetch(e, pc);
+    e->pc = (pc + 2) & (PROG_BYTES - 1);
+
+    // Byte-oriented, with a d bit: result to W or back to f
+    if ((op >= 0x0400 && op < 0x0800) || (op >= 0x1000 && op < 0x6000))
+    {
+        uint16_t a = file_addr(e, op);
+        uint8_t f = rd(e, a);
+        uint8_t w = e->ram[WREG];
+        uint8_t r;
+        int skip = 0;
+
+        switch (op >> 10)
+        {
+        case 0x01: // decf
+            r = sub(e, f, 1, 1);
+            break;
+        case 0x04: // iorwf
+            r = f | w;
+            set_zn(e, r);
+            break;
+        case 0x05: // andwf
+            r = f & w;
+            set_zn(e, r);
+            break;
+        case 0x06: // xorwf
+            r = f ^ w;
+            set_zn(e, r);
+            break;
+        case 0x07: // comf
+            r = (uint8_t) ~f;
+            set_zn(e, r);
+            break;
+        case 0x08: // addwfc
+            r = add(e, f, w, carry(e));
+            break;
+        case 0x09: // addwf
+            r = add(e, f, w, 0);
+            break;
+        case 0x0A: // incf
+            r = add(e, f, 1, 0);
+            break;
+        case 0x0B: // decfsz
+            r = (uint8_t) (f - 1);
+            skip = r == 0;
+            break;
+        case 0x0C: // rrcf
+            r = (uint8_t) (f >> 1 | (carry(e) ? 0x80 : 0));
+            e->ram[STATUS] = (uint8_t) ((e->ram[STATUS] & ~C_BIT) | (f & 1));
+            set_zn(e, r);
+            break;
+        case 0x0D: // rlcf
+            r = (uint8_t) (f << 1 | carry(e));
+            e->ram[STATUS] = (uint8_t) ((e->ram[STATUS] & ~C_BIT) | (f >> 7));
+            set_zn(e, r);
+            break;
+        case 0x0E: // swapf
+            r = (uint8_t) (f << 4 | f >> 4);
+            break;
+        case 0x0F: // incfsz
+            r = (uint8_t) (f + 1);
+            skip = r == 0;
+            break;
+        case 0x10: // rrncf
+            r = (uint8_t) (f >> 1 | f << 7);
+            set_zn(e, r);
+            break;
+        case 0x11: // rlncf
+            r = (uint8_t) (f << 1 | f >> 7);
+            set_zn(e, r);
+            break;
+        case 0x12: // infsnz
+            r = (uint8_t) (f + 1);
+            skip = r != 0;
+            break;
+        case 0x13: // dcfsnz
+            r = (uint8_t) (f - 1);
+            skip = r != 0;
+            break;
+        case 0x14: // movf
+            r = f;
+            set_zn(e, r);
+            break;
+        case 0x15: // subfwb
+            r = sub(e, w, f, carry(e));
+            break;
+        case 0x16: // subwfb
+            r = sub(e, f, w, carry(e));
+            break;
+        default: // 0x17 subwf
+            r = sub(e, f, w, 1);
+            break;
+        }
+        if (op & 0x200)
+        {
+            wr(e, a, r);
+        }
+        else
+        {
+            e->ram[WREG] = r;
+        }
+        if (skip)
+        {
+            // The skipped word runs as a nop, the second word of a two-word
+            // instruction after it is a nop anyway
+            e->pc = (e->pc + 2) & (PROG_BYTES - 1);
+            return 1;
+        }
+        return 0;
+    }
+
+    switch (op >> 12)
+    {
+    case 0x0:
+        if (op >= 0x0800) // literals
+        {
+            uint8_t k = (uint8_t) op;
+            uint8_t w = e->ram[WREG];
+            switch (op >> 8)
+            {
+            case 0x08: // sublw
+                e->ram[WREG] = sub(e, k, w, 1);
+                break;
+            case 0x09: // iorlw
+                e->ram[WREG] = w | k;
+                set_zn(e, e->ram[WREG]);
+                break;
+            case 0x0A: // xorlw
+                e->ram[WREG] = w ^ k;
+                set_zn(e, e->ram[WREG]);
+                break;
+            case 0x0B: // andlw
+                e->ram[WREG] = w & k;
+                set_zn(e, e->ram[WREG]);
+                break;
+            case 0x0C: // retlw
+                e->ram[WREG] = k;
+                e->pc = pop(e);
+                return 1;
+            case 0x0D: // mullw
+                e->ram[PRODL] = (uint8_t) (w * k);
+                e->ram[PRODH] = (uint8_t) ((w * k) >> 8);
+                break;
+            case 0x0E: // movlw
+                e->ram[WREG] = k;
+                break;
+            default: // 0x0F addlw
+                e->ram[WREG] = add(e, w, k, 0);
+                break;
+            }
+            return 0;
+        }
+        if (op >= 0x0200) // mulwf
+        {
+            uint16_t a = file_addr(e, op);
+            unsigned p = (unsigned) e->ram[WREG] * rd(e, a);
+            e->ram[PRODL] = (uint8_t) p;
+            e->ram[PRODH] = (uint8_t) (p >> 8);
+            return 0;
+        }
+        if (op >= 0x0100) // movlb
+        {
+            if (op & 0xF0)
+            {
+                illegal(e, pc, op);
+                return 0;
+            }
+            e->ram[BSR] = op & 0x0F;
+            return 0;
+        }
+        switch (op)
+        {
+        case 0x0000: // nop
+        case 0x0003: // sleep, the timer would stop, nothing here sleeps
+        case 0x0004: // clrwdt
+            return 0;
+        case 0x0005: // push
+            push(e, e->pc);
+            return 0;
+        case 0x0006: // pop
+            pop(e);
+            return 0;
+        case 0x0007: // daw
+        {
+            unsigned w = e->ram[WREG];
+            if ((w & 0x0F) > 9 || (e->ram[STATUS] & DC_BIT))
+            {
+                w += 0x06;
+            }
+            if (w > 0x9F || carry(e))
+            {
+                w += 0x60;
+            }
+            e->ram[WREG] = (uint8_t) w;
+            if (w > 0xFF)
+            {
+                e->ram[STATUS] |= C_BIT;
+            }
+            return 0;
+        }
+        case 0x0008: // tblrd*
+        case 0x0009: // tblrd*+
+        case 0x000A: // tblrd*-
+        case 0x000B: // tblrd+*
+        {
+            uint32_t t = (uint32_t) e->ram[TBLPTRU] << 16 | (uint32_t) e->ram[TBLPTRH] << 8 | e->ram[TBLPTRL];
+            if (op == 0x000B)
+            {
+                t++;
+            }
+            e->ram[TABLAT] = t < PROG_BYTES ? e->prog[t] : 0;
+            if (op == 0x0009)
+            {
+                t++;
+            }
+            else if (op == 0x000A)
+            {
+                t--;
+            }
+            t &= 0x3FFFFF;
+            e->ram[TBLPTRL] = (uint8_t) t;
+            e->ram[TBLPTRH] = (uint8_t) (t >> 8);
+            e->ram[TBLPTRU] = (uint8_t) (t >> 16);
+            return 1;
+        }
+        case 0x0010: // retfie
+        case 0x0011: // retfie fast
+            e->pc = pop(e);
+            if (op & 1)
+            {
+                restore_fast(e);
+            }
+            retfie(e);
+            return 1;
+        case 0x0012: // return
+        case 0x0013: // return fast
+            e->pc = pop(e);
+            if (op & 1)
+            {
+                restore_fast(e);
+            }
+            return 1;
+        case 0x00FF: // reset
+            e->pc = 0;
+            return 0;
+        default: // tblwt needs a programming sequence nothing here has
+            illegal(e, pc, op);
+            return 0;
+        }
+
+    case 0x6:
+    {
+        uint16_t a = file_addr(e, op);
+        uint8_t w = e->ram[WREG];
+        int skip = 0;
+        switch ((op >> 9) & 7)
+        {
+        case 0: // cpfslt
+            skip = rd(e, a) < w;
+            break;
+        case 1: // cpfseq
+            skip = rd(e, a) == w;
+            break;
+        case 2: // cpfsgt
+            skip = rd(e, a) > w;
+            break;
+        case 3: // tstfsz
+            skip = rd(e, a) == 0;
+            break;
+        case 4: // setf
+            wr(e, a, 0xFF);
+            break;
+        case 5: // clrf
+            wr(e, a, 0);
+            e->ram[STATUS] |= Z_BIT;
+            break;
+        case 6: // negf
+            wr(e, a, sub(e, 0, rd(e, a), 1));
+            break;
+        default: // movwf
+            wr(e, a, w);
+            break;
+        }
+        if (skip)
+        {
+            e->pc = (e->pc + 2) & (PROG_BYTES - 1);
+            return 1;
+        }
+        return 0;
+    }
+
+    case 0x7: // btg
+    case 0x8: // bsf
+    case 0x9: // bcf
+    case 0xA: // btfss
+    case 0xB: // btfsc
+    {
+        uint16_t a = file_addr(e, op);
+        uint8_t mask = (uint8_t) (1 << ((op >> 9) & 7));
+        uint8_t f = rd(e, a);
+        int skip = 0;
+        switch (op >> 12)
+        {
+        case 0x7:
+            wr(e, a, f ^ mask);
+            break;
+        case 0x8:
+            wr(e, a, f | mask);
+            break;
+        case 0x9:
+            wr(e, a, f & ~mask);
+            break;
+        case 0xA:
+            skip = (f & mask) != 0;
+            break;
+        default:
+            skip = (f & mask) == 0;
+            break;
+        }
+        if (skip)
+        {
+            e->pc = (e->pc + 2) & (PROG_BYTES - 1);
+            return 1;
+        }
+        return 0;
+    }
+
+    case 0xC: // movff
+    {
+        uint16_t dst_op = fetch(e, e->pc);
+        e->pc = (e->pc + 2) & (PROG_BYTES - 1);
+        if ((dst_op & 0xF000) != 0xF000)
+        {
+            illegal(e, pc, op);
+            return 0;
+        }
+        uint16_t src = op & 0xFFF;
+        uint16_t dst = dst_op & 0xFFF;
+        uint8_t v = rd(e, indirect(e, src));
+        wr(e, indirect(e, dst), v);
+        return 1;
+    }
+
+    case 0xD: // bra, rcall
+    {
+        int n = op & 0x7FF;
+        if (n & 0x400)
+        {
+            n -= 0x800;
+        }
+        if (op & 0x800)
+        {
+            push(e, e->pc);
+        }
+        e->pc = (uint32_t) ((int) e->pc + 2 * n) & (PROG_BYTES - 1);
+        return 1;
+    }
+
+    case 0xE:
+        if (op < 0xE800) // conditional branches
+        {
+            uint8_t s = e->ram[STATUS];
+            int taken;
+            switch ((op >> 8) & 7)
+            {
+            case 0:
+                taken = (s & Z_BIT) != 0;
+                break;
+            case 1:
+                taken = !(s & Z_BIT);
+                break;
+            case 2:
+                taken = (s & C_BIT) != 0;
+                break;
+            case 3:
+                taken = !(s & C_BIT);
+                break;
+            case 4:
+                taken = (s & OV_BIT) != 0;
+                break;
+            case 5:
+                taken = !(s & OV_BIT);
+                break;
+            case 6:
+                taken = (s & N_BIT) != 0;
+                break;
+            default:
+                taken = !(s & N_BIT);
+                break;
+            }
+            if (!taken)
+            {
+                return 0;
+            }
+            e->pc = (uint32_t) ((int) e->pc + 2 * (int8_t) op) & (PROG_BYTES - 1);
+            return 1;
+        }
+        {
+            uint16_t hi = fetch(e, e->pc);
+            if ((hi & 0xF000) != 0xF000 || (op >= 0xEE00 && op < 0xEF00 && (op & 0xC0)))
+            {
+                illegal(e, pc, op);
+                return 0;
+            }
+            e->pc = (e->pc + 2) & (PROG_BYTES - 1);
+            if (op >= 0xEF00) // goto
+            {
+                e->pc = ((uint32_t) (hi & 0xFFF) << 9 | (uint32_t) (op & 0xFF) << 1) & (PROG_BYTES - 1);
+                return 1;
+            }
+            if (op >= 0xEE00) // lfsr
+            {
+                static const uint16_t fsr[3] = {FSR0L, FSR1L, FSR2L};
+                int n = (op >> 4) & 3;
+                if (n == 3)
+                {
+                    illegal(e, pc, op);
+                    return 0;
+                }
+                e->ram[fsr[n]] = (uint8_t) hi;
+                e->ram[fsr[n] + 1] = op & 0x0F;
+                return 1;
+            }
+            if (op >= 0xEC00) // call
+            {
+                push(e, e->pc);
+                if (op & 0x100)
+                {
+                    save_fast(e);
+                }
+                e->pc = ((uint32_t) (hi & 0xFFF) << 9 | (uint32_t) (op & 0xFF) << 1) & (PROG_BYTES - 1);
+                return 1;
+            }
+            illegal(e, pc, op); // the extended instructions
+            return 0;
+        }
+
+    case 0xF: // second word of a two-word instruction, runs as a nop
+        return 0;
+
+    default: // 0x1 to 0x5 are byte-oriented, handled above
+        illegal(e, pc, op);
+        return 0;
+    }
+}
+
+/* **** Interface for emu.py **** */
+emu_t* emu_new(void)
+{
+    return calloc(1, sizeof(emu_t));
+}
+
+void emu_free(emu_t* e)
+{
+    free(e);
+}
+
+/* Power-on reset, the program and the watches are kept */
+void emu_reset(emu_t* e)
+{
+    memset(e->ram, 0, sizeof(e->ram));
+    memset(e->pins, 0, sizeof(e->pins));
+    memset(&e->ram[TRISA], 0xFF, N_PORTS);
+    e->ram[T0CON] = 0xFF;
+    e->ram[INTCON2] = 0xFF;
+    e->ram[RCON] = 0x1C;
+    e->pc = 0;
+    e->sp = 0;
+    e->ws = e->statuss = e->bsrs = 0;
+    e->tmr0 = 0;
+    e->tmr0h_buf = 0;
+    e->prescale = 0;
+    e->inhibit = 0;
+    e->in_high = 0;
+    e->cycles = 0;
+    e->hit = 0;
+    e->halted = 0;
+    e->error[0] = '\0';
+}
+
+static int hex_byte(const char* s)
+{
+    int v = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        char c = s[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9')
+        {
+            v |= c - '0';
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            v |= c - 'A' + 10;
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            v |= c - 'a' + 10;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    return v;
+}
+
+/*
+ * Loads an Intel hex file into program memory, erased to FFh first. Bytes
+ * past the program memory, the CONFIG and ID words, are ignored. Returns 0,
+ * or -1 with emu_error saying why.
+ */
+int emu_load_hex(emu_t* e, const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+        snprintf(e->error, sizeof(e->error), "cannot open %s", path);
+        return -1;
+    }
+
+    memset(e->prog, 0xFF, sizeof(e->prog));
+    char line[600];
+    uint32_t upper = 0;
+    int lineno = 0;
+    int ok = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        lineno++;
+        char* s = line;
+        if (*s != ':')
+        {
+            continue;
+        }
+        s++;
+        uint8_t rec[256 + 5];
+        int n = 0;
+        while (n < (int) sizeof(rec) && s[0] && s[0] != '\r' && s[0] != '\n')
+        {
+            int b = hex_byte(s);
+            if (b < 0)
+            {
+                break;
+            }
+            rec[n++] = (uint8_t) b;
+            s += 2;
+        }
+        uint8_t sum = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            sum = (uint8_t) (sum + rec[i]);
+        }
+        if (n < 5 || n != rec[0] + 5 || sum != 0)
+        {
+            snprintf(e->error, sizeof(e->error), "%s:%d: bad record", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        uint32_t addr = upper | (uint32_t) rec[1] << 8 | rec[2];
+        switch (rec[3])
+        {
+        case 0:
+            for (int i = 0; i < rec[0]; ++i)
+            {
+                if (addr + i < PROG_BYTES)
+                {
+                    e->prog[addr + i] = rec[4 + i];
+                }
+            }
+            break;
+        case 1:
+            ok = 1;
+            break;
+        case 2:
+            upper = ((uint32_t) rec[4] << 8 | rec[5]) << 4;
+            break;
+        case 4:
+            upper = ((uint32_t) rec[4] << 8 | rec[5]) << 16;
+            break;
+        default:
+            break;
+        }
+        if (ok)
+        {
+            break;
+        }
+    }
+    fclose(f);
+    if (!ok)
+    {
+        snprintf(e->error, sizeof(e->error), "%s: no end of file record", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Runs until max_cycles more cycles have passed or an instruction wrote a
+ * watched address. Returns 1 for the watch, 0 for the cycles and -1 if an
+ * illegal instruction stopped it.
+ */
+int emu_run(emu_t* e, uint64_t max_cycles)
+{
+    uint64_t end = e->cycles + max_cycles;
+    if (e->halted)
+    {
+        return -1;
+    }
+    e->hit = 0;
+    while (e->cycles < end)
+    {
+        if ((e->ram[INTCON] & TMR0IF) && interrupt(e))
+        {
+            continue;
+        }
+        // The first cycle of the instruction, Timer0 counts before it reads
+        tick(e, 1);
+        tick(e, (unsigned) step(e));
+        if (e->halted)
+        {
+            return -1;
+        }
+        if (e->hit)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+uint64_t emu_cycles(const emu_t* e)
+{
+    return e->cycles;
+}
+
+uint32_t emu_pc(const emu_t* e)
+{
+    return e->pc;
+}
+
+const char* emu_error(const emu_t* e)
+{
+    return e->error;
+}
+
+/* A register as a read would see it, without the side effects of one */
+int emu_peek(emu_t* e, unsigned addr)
+{
+    if (addr >= DATA_SIZE)
+    {
+        return -1;
+    }
+    if (addr == TMR0L)
+    {
+        return e->tmr0 & 0xFF;
+    }
+    if (addr == TMR0H)
+    {
+        return e->tmr0h_buf;
+    }
+    if ((addr >= PORTA && addr < PORTA + N_PORTS) || addr == PCL || addr >= STKPTR)
+    {
+        uint8_t lath = e->ram[PCLATH];
+        uint8_t latu = e->ram[PCLATU];
+        int v = rd(e, (uint16_t) addr);
+        e->ram[PCLATH] = lath;
+        e->ram[PCLATU] = latu;
+        return v;
+    }
+    return e->ram[addr];
+}
+
+void emu_poke(emu_t* e, unsigned addr, unsigned value)
+{
+    if (addr < DATA_SIZE)
+    {
+        e->ram[addr] = (uint8_t) value;
+    }
+}
+
+void emu_watch(emu_t* e, unsigned addr, int on)
+{
+    if (addr < DATA_SIZE)
+    {
+        e->watch[addr] = (uint8_t) (on != 0);
+    }
+}
+
+void emu_clear_watches(emu_t* e)
+{
+    memset(e->watch, 0, sizeof(e->watch));
+}
+
+/* Drives pin bit of port (0 for PORTA) to level */
+void emu_set_pin(emu_t* e, int port, int bit, int level)
+{
+    if (port < 0 || port >= N_PORTS || bit < 0 || bit > 7)
+    {
+        return;
+    }
+    if (level)
+    {
+        e->pins[port] |= (uint8_t) (1 << bit);
+    }
+    else
+    {
+        e->pins[port] &= (uint8_t) ~(1 << bit);
+    }
+}
@@ -0,0 +1,344 @@
+"""
+Reader for the PIC18 assembly the THE1 firmware is written in, shared by the
+host tools. It takes pic-as source, main.s or the preprocessed
+build/default/*/main.i, and resolves it to a list of instructions with
+numeric operands: RAM addresses of the udata_acs variables as the linker
+allocates them, PIC18F8722 SFR addresses, EQU constants and code labels.
+"""
+
+import re
+
+# PIC18F8722 special function registers, from the device include of pic-as
+SFR = {
+    "SSP2CON2": 0xF62, "SSP2CON1": 0xF63, "SSP2STAT": 0xF64, "SSP2ADD": 0xF65,
+    "SSP2BUF": 0xF66, "ECCP2DEL": 0xF67, "ECCP2AS": 0xF68, "ECCP3DEL": 0xF69,
+    "ECCP3AS": 0xF6A, "RCSTA2": 0xF6B, "TXSTA2": 0xF6C, "TXREG2": 0xF6D,
+    "RCREG2": 0xF6E, "SPBRG2": 0xF6F, "CCP5CON": 0xF70, "CCPR5": 0xF71,
+    "CCPR5L": 0xF71, "CCPR5H": 0xF72, "CCP4CON": 0xF73, "CCPR4": 0xF74,
+    "CCPR4L": 0xF74, "CCPR4H": 0xF75, "T4CON": 0xF76, "PR4": 0xF77,
+    "TMR4": 0xF78, "ECCP1DEL": 0xF79, "BAUDCON2": 0xF7C, "SPBRGH2": 0xF7D,
+    "BAUDCON1": 0xF7E, "SPBRGH1": 0xF7F, "PORTA": 0xF80, "PORTB": 0xF81,
+    "PORTC": 0xF82, "PORTD": 0xF83, "PORTE": 0xF84, "PORTF": 0xF85,
+    "PORTG": 0xF86, "PORTH": 0xF87, "PORTJ": 0xF88, "LATA": 0xF89,
+    "LATB": 0xF8A, "LATC": 0xF8B, "LATD": 0xF8C, "LATE": 0xF8D, "LATF": 0xF8E,
+    "LATG": 0xF8F, "LATH": 0xF90, "LATJ": 0xF91, "TRISA": 0xF92,
+    "TRISB": 0xF93, "TRISC": 0xF94, "TRISD": 0xF95, "TRISE": 0xF96,
+    "TRISF": 0xF97, "TRISG": 0xF98, "TRISH": 0xF99, "TRISJ": 0xF9A,
+    "OSCTUNE": 0xF9B, "MEMCON": 0xF9C, "PIE1": 0xF9D, "PIR1": 0xF9E,
+    "IPR1": 0xF9F, "PIE2": 0xFA0, "PIR2": 0xFA1, "IPR2": 0xFA2, "PIE3": 0xFA3,
+    "PIR3": 0xFA4, "IPR3": 0xFA5, "EECON1": 0xFA6, "EECON2": 0xFA7,
+    "EEDATA": 0xFA8, "EEADR": 0xFA9, "EEADRH": 0xFAA, "RCSTA1": 0xFAB,
+    "TXSTA1": 0xFAC, "TXREG1": 0xFAD, "RCREG1": 0xFAE, "SPBRG1": 0xFAF,
+    "PSPCON": 0xFB0, "T3CON": 0xFB1, "TMR3": 0xFB2, "TMR3L": 0xFB2,
+    "TMR3H": 0xFB3, "CMCON": 0xFB4, "CVRCON": 0xFB5, "ECCP1AS": 0xFB6,
+    "CCP3CON": 0xFB7, "CCPR3": 0xFB8, "CCPR3L": 0xFB8, "CCPR3H": 0xFB9,
+    "CCP2CON": 0xFBA, "CCPR2": 0xFBB, "CCPR2L": 0xFBB, "CCPR2H": 0xFBC,
+    "CCP1CON": 0xFBD, "CCPR1": 0xFBE, "CCPR1L": 0xFBE, "CCPR1H": 0xFBF,
+    "ADCON2": 0xFC0, "ADCON1": 0xFC1, "ADCON0": 0xFC2, "ADRES": 0xFC3,
+    "ADRESL": 0xFC3, "ADRESH": 0xFC4, "SSP1CON2": 0xFC5, "SSP1CON1": 0xFC6,
+    "SSP1STAT": 0xFC7, "SSP1ADD": 0xFC8, "SSP1BUF": 0xFC9, "T2CON": 0xFCA,
+    "PR2": 0xFCB, "TMR2": 0xFCC, "T1CON": 0xFCD, "TMR1": 0xFCE, "TMR1L": 0xFCE,
+    "TMR1H": 0xFCF, "RCON": 0xFD0, "WDTCON": 0xFD1, "HLVDCON": 0xFD2,
+    "OSCCON": 0xFD3, "T0CON": 0xFD5, "TMR0": 0xFD6, "TMR0L": 0xFD6,
+    "TMR0H": 0xFD7, "STATUS": 0xFD8, "FSR2": 0xFD9, "FSR2L": 0xFD9,
+    "FSR2H": 0xFDA, "PLUSW2": 0xFDB, "PREINC2": 0xFDC, "POSTDEC2": 0xFDD,
+    "POSTINC2": 0xFDE, "INDF2": 0xFDF, "BSR": 0xFE0, "FSR1": 0xFE1,
+    "FSR1L": 0xFE1, "FSR1H": 0xFE2, "PLUSW1": 0xFE3, "PREINC1": 0xFE4,
+    "POSTDEC1": 0xFE5, "POSTINC1": 0xFE6, "INDF1": 0xFE7, "WREG": 0xFE8,
+    "FSR0": 0xFE9, "FSR0L": 0xFE9, "FSR0H": 0xFEA, "PLUSW0": 0xFEB,
+    "PREINC0": 0xFEC, "POSTDEC0": 0xFED, "POSTINC0": 0xFEE, "INDF0": 0xFEF,
+    "INTCON3": 0xFF0, "INTCON2": 0xFF1, "INTCON": 0xFF2, "PROD": 0xFF3,
+    "PRODL": 0xFF3, "PRODH": 0xFF4, "TABLAT": 0xFF5, "TBLPTR": 0xFF6,
+    "TBLPTRL": 0xFF6, "TBLPTRH": 0xFF7, "TBLPTRU": 0xFF8, "PCL": 0xFF9,
+    "PCLAT": 0xFF9, "PCLATH": 0xFFA, "PCLATU": 0xFFB, "STKPTR": 0xFFC,
+    "TOS": 0xFFD, "TOSL": 0xFFD, "TOSH": 0xFFE, "TOSU": 0xFFF,
+}
+
+# Instruction formats, by what the operands are
+FILE_D = {"addwf", "addwfc", "andwf", "comf", "decf", "decfsz", "dcfsnz",
+          "incf", "incfsz", "infsnz", "iorwf", "movf", "rlcf", "rlncf",
+          "rrcf", "rrncf", "subfwb", "subwf", "subwfb", "swapf", "xorwf"}
+FILE_A = {"clrf", "cpfseq", "cpfsgt", "cpfslt", "movwf", "mulwf", "negf",
+          "setf", "tstfsz"}
+BIT = {"bcf", "bsf", "btfsc", "btfss", "btg"}
+LITERAL = {"addlw", "andlw", "iorlw", "movlb", "movlw", "mullw", "retlw",
+           "sublw", "xorlw"}
+BRANCH = {"bc", "bn", "bnc", "bnn", "bnov", "bnz", "bov", "bz", "bra"}
+CONTROL = {"goto", "call", "rcall", "return", "retfie"}
+INHERENT = {"clrwdt", "daw", "nop", "pop", "push", "reset", "sleep",
+            "tblrd*", "tblrd*+", "tblrd*-", "tblrd+*",
+            "tblwt*", "tblwt*+", "tblwt*-", "tblwt+*"}
+SKIPS = {"btfsc", "btfss", "cpfseq", "cpfsgt", "cpfslt", "decfsz", "dcfsnz",
+         "incfsz", "infsnz", "tstfsz"}
+TWO_WORD = {"call", "goto", "lfsr", "movff"}
+
+# Where the vector psects go, as the -P options of the link line put them
+PLACEMENT = {"resetVec": 0x00, "hiIntVec": 0x08, "loIntVec": 0x18}
+
+# Base address of the RAM psects DS allocates in
+RAM_BASE = {"udata_acs": 0x000}
+RAM_BASE.update({"udata_bank%d" % n: 0x100 * n for n in range(16)})
+
+
+class AsmError(Exception):
+    pass
+
+
+class Insn:
+    """
+    One instruction. f is a full 12-bit file address, d is 1 for F and 0 for
+    W, b a bit number, k a literal, target the index of a branch target in
+    Program.insns. Operands that did not resolve are None.
+    """
+
+    def __init__(self, mnem, ops, line, text):
+        self.mnem = mnem
+        self.ops = ops
+        self.line = line
+        self.text = text
+        self.labels = []
+        self.psect = None
+        self.addr = None
+        self.words = 2 if mnem in TWO_WORD else 1
+        self.f = self.f2 = self.d = self.b = self.k = None
+        self.target = None
+        self.fast = 0
+
+    def __repr__(self):
+        return "%d: %s" % (self.line, self.text)
+
+
+class Program:
+    def __init__(self):
+        self.insns = []
+        self.labels = {}   # label: index in insns
+        self.symbols = {}  # every name with a value
+        self.start = None  # label named by the end directive
+        self.vectors = []  # (psect, index of its first instruction)
+
+    def at(self, label):
+        if label not in self.labels:
+            raise AsmError("no label %s" % label)
+        return self.labels[label]
+
+    def name(self, i):
+        """The first label of instruction i, or its address"""
+        insn = self.insns[i]
+        return insn.labels[0] if insn.labels else "%05Xh" % insn.addr
+
+
+_NUMBER = re.compile(r"\b(0[xX][0-9a-fA-F]+|[0-9][0-9a-fA-F]*[hH]|[01]+[bB]|[0-9]+)\b")
+_NAME = re.compile(r"\b([A-Za-z_?$][\w?$]*)\b")
+
+
+def _number(tok):
+    if tok[:2] in ("0x", "0X"):
+        return int(tok, 16)
+    if tok[-1] in "hH":
+        return int(tok[:-1], 16)
+    if tok[-1] in "bB":
+        return int(tok[:-1], 2)
+    return int(tok, 10)
+
+
+def evaluate(expr, symbols):
+    """Value of a pic-as expression, None if it names an unknown symbol"""
+    expr = expr.strip()
+    if not expr:
+        return None
+    unknown = []
+
+    def name(m):
+        n = m.group(1)
+        if n in ("low", "high", "LOW", "HIGH"):
+            return n.lower()
+        if n in symbols:
+            return "(%d)" % symbols[n]
+        unknown.append(n)
+        return "0"
+
+    # Numbers first, so 0Fh and 101B are not taken for names
+    parts = []
+    pos = 0
+    for m in _NUMBER.finditer(expr):
+        parts.append(_NAME.sub(name, expr[pos:m.start()]))
+        parts.append(str(_number(m.group(1))))
+        pos = m.end()
+    parts.append(_NAME.sub(name, expr[pos:]))
+    if unknown:
+        return None
+    try:
+        return int(eval("".join(parts), {"__builtins__": {}},
+                        {"low": lambda v: v & 0xFF, "high": lambda v: (v >> 8) & 0xFF}))
+    except Exception:
+        raise AsmError("cannot evaluate %s" % expr)
+
+
+def _split_ops(s):
+    return [o.strip() for o in s.split(",")] if s.strip() else []
+
+
+def _strip_comment(line):
+    # No string operands in this code, so the first ; starts the comment
+    i = line.find(";")
+    return line if i < 0 else line[:i]
+
+
+def read(path, placement=PLACEMENT):
+    """Parses a pic-as source file into a Program"""
+    prog = Program()
+    prog.symbols.update(SFR)
+    data_psect = None
+    code_psect = None
+    ram = dict(RAM_BASE)
+    pending = []   # labels waiting for the next instruction
+    order = []     # code psects in order of appearance
+    in_macro = False
+
+    with open(path) as f:
+        lines = f.read().split("\n")
+
+    for lineno, raw in enumerate(lines, 1):
+        if raw.startswith("#"):
+            continue
+        text = _strip_comment(raw).strip()
+        if not text:
+            continue
+        words = text.split(None, 1)
+        upper = words[0].upper()
+
+        # Macro bodies of the device include are not instructions
+        if in_macro:
+            if upper == "ENDM":
+                in_macro = False
+            continue
+        if len(words) > 1 and words[1].split(None, 1)[0].upper() == "MACRO":
+            in_macro = True
+            continue
+
+        m = re.match(r"([A-Za-z_?$][\w?$]*):\s*(.*)$", text)
+        if m:
+            label, text = m.group(1), m.group(2)
+            if data_psect is not None:
+                prog.symbols[label] = ram[data_psect]
+            else:
+                pending.append(label)
+            if not text:
+                continue
+            words = text.split(None, 1)
+            upper = words[0].upper()
+
+        rest = words[1] if len(words) > 1 else ""
+        if upper in ("PROCESSOR", "GLOBAL", "CONFIG", "RADIX", "IF", "ELSIF",
+                     "ELSE", "ENDIF", "ALLOC_STACK", "RESTORE_STACK"):
+            continue
+        if upper == "PSECT":
+            name = _split_ops(rest)[0]
+            if name in ram:
+                data_psect, code_psect = name, None
+            elif "noexec" in rest.split(",") or "space=1" in rest.replace(" ", ""):
+                data_psect, code_psect = None, None
+                ram.setdefault(name, 0)
+            else:
+                data_psect, code_psect = None, name
+                if name not in order:
+                    order.append(name)
+            continue
+        if upper == "DS":
+            if data_psect is None:
+                raise AsmError("%s:%d: DS outside a RAM psect" % (path, lineno))
+            ram[data_psect] += evaluate(rest, prog.symbols)
+            continue
+        if upper == "END":
+            prog.start = rest.strip() or None
+            break
+        if len(words) > 1 and words[1].split(None, 1)[0].upper() in ("EQU", "SET"):
+            value = evaluate(words[1].split(None, 1)[1], prog.symbols)
+            if value is not None:
+                prog.symbols[words[0]] = value
+            continue
+
+        if code_psect is None:
+            raise AsmError("%s:%d: instruction outside a code psect: %s" % (path, lineno, text))
+        insn = Insn(words[0].lower(), _split_ops(rest), lineno, raw.strip())
+        insn.psect = code_psect
+        insn.labels = pending
+        pending = []
+        prog.insns.append(insn)
+
+    # Lay the psects out: vectors where placed, the rest after them
+    by_psect = {p: [i for i in prog.insns if i.psect == p] for p in order}
+    addr = max([placement[p] + 2 * sum(i.words for i in by_psect[p])
+                for p in order if p in placement] + [0])
+    for p in order:
+        if p in placement:
+            pc = placement[p]
+        else:
+            pc = addr
+        for insn in by_psect[p]:
+            insn.addr = pc
+            pc += 2 * insn.words
+        if p not in placement:
+            addr = pc
+    prog.insns.sort(key=lambda i: i.addr)
+    for n, insn in enumerate(prog.insns):
+        for label in insn.labels:
+            prog.labels[label] = n
+            prog.symbols[label] = insn.addr
+    for p in order:
+        if p in placement and by_psect[p]:
+            prog.vectors.append((p, prog.insns.index(by_psect[p][0])))
+
+    for insn in prog.insns:
+        _resolve(prog, insn, path)
+    return prog
+
+
+def _file(prog, op):
+    return evaluate(op, prog.symbols)
+
+
+def _dest(op):
+    op = op.strip().upper()
+    if op in ("W", "0"):
+        return 0
+    if op in ("F", "1"):
+        return 1
+    raise AsmError("bad destination %s" % op)
+
+
+def _resolve(prog, insn, path):
+    m, ops = insn.mnem, insn.ops
+    sym = prog.symbols
+    try:
+        if m in FILE_D:
+            insn.f = _file(prog, ops[0])
+            # pic-as takes the access bit alone as the second operand too
+            insn.d = _dest(ops[1]) if len(ops) > 1 and ops[1].strip().upper() not in ("A", "B", "C") else 1
+        elif m in FILE_A:
+            insn.f = _file(prog, ops[0])
+        elif m in BIT:
+            insn.f = _file(prog, ops[0])
+            insn.b = evaluate(ops[1], sym)
+        elif m in LITERAL:
+            insn.k = evaluate(ops[0], sym) if ops else 0
+        elif m == "lfsr":
+            insn.f = evaluate(ops[0], sym)
+            insn.k = evaluate(ops[1], sym)
+        elif m == "movff":
+            insn.f = _file(prog, ops[0])
+            insn.f2 = _file(prog, ops[1])
+        elif m in BRANCH or m in ("goto", "call", "rcall"):
+            target = ops[0].strip()
+            if target not in prog.labels:
+                raise AsmError("no label %s" % target)
+            insn.target = prog.labels[target]
+            insn.fast = evaluate(ops[1], sym) if len(ops) > 1 else 0
+        elif m in ("return", "retfie"):
+            insn.fast = evaluate(ops[0], sym) if ops else 0
+        elif m not in INHERENT:
+            raise AsmError("unknown instruction")
+    except (AsmError, IndexError) as e:
+        raise AsmError("%s:%d: %s: %s" % (path, insn.line, insn.text, e))
+    if insn.k is not None:
+        insn.k &= 0xFF if m != "lfsr" else 0xFFF
@@ -0,0 +1,690 @@
+"""
+Static best and worst case cycle counts of the THE1 firmware.
+
+Every routine of the program is analyzed on its own: the entry of every
+vector and every call target, plus the loops named with -l, where one pass
+is from the label back to it. The code is executed with the values it can
+know (literals, the RAM it wrote itself, FSRs) and both ways at every skip
+or branch that depends on anything else, like PORTE or a RAM byte the
+routine did not write. That follows counter loops such as decfsz, incfsz
+or decf/bnz exactly, however they are nested, without annotations. A loop
+whose exit depends on an unknown value can take forever, the routine is
+reported as unbounded there. RAM the ISRs write can change at any moment
+and is never known outside of them. A write through an FSR whose low byte
+is unknown is taken to hit any byte of its page but the FSRs, WREG and
+STATUS.
+
+Cycles follow the PIC18 instruction set: 1 per instruction, 2 for goto,
+bra, call, rcall, return, retfie, retlw, movff, lfsr and a taken
+conditional branch, 2 for a skip over a one-word instruction and 3 over a
+two-word one. A call costs 2 plus the callee. Interrupts are not included:
+every ISR run adds its own cycles and 3 to 4 of latency to the code it
+preempts.
+
+Usage: wcet.py [-f MHz] [-l label]... [-b budget] source
+  -f  instruction clock, Fosc/4, in MHz the times are given at (default 1,
+      the clock tests/test.py counts in; the board runs at 10)
+  -l  also report one pass of the loop at this label
+  -b  file of "name cycles" lines; exits 1 if the worst case of a name is
+      over its cycles or unbounded
+"""
+
+import argparse
+import heapq
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import pic18  # noqa: E402
+
+INF = float("inf")
+
+# Returned by a step that leaves the routine
+END = "end"
+
+# Walking straight code this long without a branch means it never stops
+MAX_STEPS = 50 * 1000 * 1000
+
+# Distinct states at branches before giving up on a routine
+MAX_STATES = 20 * 1000
+
+SFR = pic18.SFR
+WREG = SFR["WREG"]
+STATUS = SFR["STATUS"]
+FSR_L = [SFR["FSR0L"], SFR["FSR1L"], SFR["FSR2L"]]
+FSR_H = [SFR["FSR0H"], SFR["FSR1H"], SFR["FSR2H"]]
+FSRS = set(FSR_L + FSR_H)
+INDIRECT = {}
+for _n in range(3):
+    for _mode in ("INDF", "POSTINC", "POSTDEC", "PREINC", "PLUSW"):
+        INDIRECT[SFR["%s%d" % (_mode, _n)]] = (_n, _mode)
+
+# Flag and value each conditional branch is taken on, OV is never known
+BRANCH_ON = {"bc": ("c", 1), "bnc": ("c", 0), "bz": ("z", 1), "bnz": ("z", 0),
+             "bn": ("n", 1), "bnn": ("n", 0), "bov": (None, 1), "bnov": (None, 0)}
+
+# Status bits btfsc and btfss can test
+STATUS_C = 0
+STATUS_Z = 2
+STATUS_N = 4
+
+
+class Unbounded(Exception):
+    pass
+
+
+class State:
+    """
+    Where the code is and what it knows: mem holds the RAM and FSR bytes
+    with a known value, w and the c, z and n flags are None when unknown.
+    """
+    __slots__ = ("pc", "mem", "w", "c", "z", "n")
+
+    def __init__(self, pc):
+        self.pc = pc
+        self.mem = {}
+        self.w = self.c = self.z = self.n = None
+
+    def copy(self):
+        s = State(self.pc)
+        s.mem = dict(self.mem)
+        s.w, s.c, s.z, s.n = self.w, self.c, self.z, self.n
+        return s
+
+    def key(self):
+        return (self.pc, frozenset(self.mem.items()), self.w, self.c, self.z, self.n)
+
+
+class Result:
+    def __init__(self, name, best, worst, writes, why=None):
+        self.name = name
+        self.best = best      # None if it never returns
+        self.worst = worst    # INF if unbounded
+        self.writes = writes  # RAM it can write, None for any
+        self.why = why        # label of the loop that makes it unbounded
+
+
+def signed(v):
+    return v - 256 if v & 0x80 else v
+
+
+class Analyzer:
+    def __init__(self, prog):
+        self.prog = prog
+        self.volatile = set()
+        self.results = {}
+        self.active = set()
+        # Per routine being explored, innermost last
+        self.writes = []
+        self.stop = []
+        self.why = []
+
+    # **** Memory ****
+    def fsr(self, st, n):
+        """
+        Address in FSRn, or the range of 256 addresses it is in when only
+        FSRnH is known, or None
+        """
+        lo = st.mem.get(FSR_L[n])
+        hi = st.mem.get(FSR_H[n])
+        if hi is None:
+            return None
+        if lo is None:
+            return range((hi & 0x0F) << 8, ((hi & 0x0F) << 8) + 0x100)
+        return ((hi & 0x0F) << 8) | lo
+
+    def set_fsr(self, st, n, v):
+        self.note_write(FSR_L[n])
+        self.note_write(FSR_H[n])
+        if v is None:
+            st.mem.pop(FSR_L[n], None)
+            st.mem.pop(FSR_H[n], None)
+        else:
+            st.mem[FSR_L[n]] = v & 0xFF
+            st.mem[FSR_H[n]] = (v >> 8) & 0x0F
+
+    def address(self, st, f):
+        """Address f stands for, moving the FSR of a POSTINC and the like"""
+        if f not in INDIRECT:
+            return f
+        n, mode = INDIRECT[f]
+        cur = self.fsr(st, n)
+        if isinstance(cur, range):
+            if mode != "INDF":
+                self.set_fsr(st, n, None)
+            return None if mode == "PLUSW" else cur
+        if mode == "INDF":
+            return cur
+        if mode == "PLUSW":
+            return None if cur is None or st.w is None else (cur + signed(st.w)) & 0xFFF
+        if mode == "PREINC":
+            cur = None if cur is None else (cur + 1) & 0xFFF
+            self.set_fsr(st, n, cur)
+            return cur
+        self.set_fsr(st, n, None if cur is None else (cur + (1 if mode == "POSTINC" else -1)) & 0xFFF)
+        return cur
+
+    def read(self, st, addr):
+        if addr is None or isinstance(addr, range) or addr in self.volatile:
+            return None
+        if addr == WREG:
+            return st.w
+        if addr < 0xF60 or addr in FSRS:
+            return st.mem.get(addr)
+        return None  # the other SFRs change on their own
+
+    def note_write(self, addr):
+        if self.writes and self.writes[-1] is not None:
+            if addr is None:
+                self.writes[-1] = None
+            elif isinstance(addr, range):
+                self.writes[-1].update(a for a in addr if a < 0xF60)
+            elif addr < 0xF60 or addr in FSRS:
+                self.writes[-1].add(addr)
+
+    def write(self, st, addr, v):
+        self.note_write(addr)
+        if addr is None:
+            st.mem.clear()
+        elif isinstance(addr, range):
+            # Taken not to be an FSR, WREG or STATUS, code does not do that
+            for a in [a for a in st.mem if a in addr and a not in FSRS]:
+                del st.mem[a]
+        elif addr == WREG:
+            st.w = v
+        elif addr == STATUS:
+            if v is None:
+                st.c = st.z = st.n = None
+            else:
+                st.c, st.z, st.n = v & 1, (v >> 2) & 1, (v >> 4) & 1
+        elif addr in self.volatile:
+            pass
+        elif addr < 0xF60 or addr in FSRS:
+            if v is None:
+                st.mem.pop(addr, None)
+            else:
+                st.mem[addr] = v & 0xFF
+
+    def bit(self, st, addr, b):
+        if isinstance(addr, range):
+            return None
+        if addr == STATUS:
+            return {STATUS_C: st.c, STATUS_Z: st.z, STATUS_N: st.n}.get(b)
+        v = self.read(st, addr)
+        return None if v is None else (v >> b) & 1
+
+    # **** Instructions ****
+    def alu(self, st, m, f, w):
+        """Result of a byte operation and the flags it sets, None if unknown"""
+        c = st.c
+        known = f is not None and w is not None
+        r = None
+        carry = "keep"
+        if m in ("movf", "comf", "decf", "incf", "negf", "rlncf", "rrncf", "swapf",
+                 "decfsz", "dcfsnz", "incfsz", "infsnz"):
+            known = f is not None
+        if m in ("addwfc", "subwfb", "subfwb", "rlcf", "rrcf") and c is None:
+            known = False
+        if known:
+            if m in ("addwf", "addlw"):
+                r = f + w
+                carry = r > 0xFF
+            elif m == "addwfc":
+                r = f + w + c
+                carry = r > 0xFF
+            elif m in ("andwf", "andlw"):
+                r = f & w
+            elif m in ("iorwf", "iorlw"):
+                r = f | w
+            elif m in ("xorwf", "xorlw"):
+                r = f ^ w
+            elif m == "comf":
+                r = ~f
+            elif m in ("decf", "decfsz", "dcfsnz"):
+                r = f - 1
+                carry = f != 0 if m == "decf" else "keep"
+            elif m in ("incf", "incfsz", "infsnz"):
+                r = f + 1
+                carry = f == 0xFF if m == "incf" else "keep"
+            elif m == "movf":
+                r = f
+            elif m == "negf":
+                r = -f
+                carry = f == 0
+            elif m == "rlcf":
+                r = (f << 1) | c
+                carry = f >> 7
+            elif m == "rlncf":
+                r = (f << 1) | (f >> 7)
+            elif m == "rrcf":
+                r = (f >> 1) | (c << 7)
+                carry = f & 1
+            elif m == "rrncf":
+                r = (f >> 1) | ((f & 1) << 7)
+            elif m == "swapf":
+                r = ((f << 4) | (f >> 4))
+            elif m in ("subwf", "sublw"):
+                r = f - w
+                carry = f >= w
+            elif m == "subwfb":
+                r = f - w - (1 - c)
+                carry = r >= 0
+            elif m == "subfwb":
+                r = w - f - (1 - c)
+                carry = r >= 0
+            r &= 0xFF
+        elif m in ("addwf", "addlw", "addwfc", "negf", "rlcf", "rrcf", "subwf", "sublw",
+                   "subwfb", "subfwb") or m == "decf" or m == "incf":
+            carry = None
+        # Flags: everything but the movff, swapf and the skips sets Z and N
+        if m not in ("swapf", "decfsz", "dcfsnz", "incfsz", "infsnz"):
+            st.z = None if r is None else int(r == 0)
+            st.n = None if r is None else r >> 7
+        if carry != "keep":
+            st.c = None if carry is None else int(carry)
+        return r
+
+    def step(self, st):
+        """
+        Executes the instruction at st.pc. Returns [((lo, hi), next)], next
+        is st itself when there is one way on, copies when there are two, and
+        END when the routine returns.
+        """
+        prog = self.prog
+        i = st.pc
+        if i >= len(prog.insns):
+            raise pic18.AsmError("runs off the end of the code")
+        insn = prog.insns[i]
+        m = insn.mnem
+
+        def skip(cond, on_skip=None, on_fall=None):
+            after = prog.insns[i + 1] if i + 1 < len(prog.insns) else None
+            cost = 1 + (after.words if after else 1)
+            if cond is not None:
+                st.pc = i + 2 if cond else i + 1
+                return [((cost, cost) if cond else (1, 1), st)]
+            a, b = st.copy(), st
+            a.pc, b.pc = i + 2, i + 1
+            if on_skip:
+                on_skip(a)
+            if on_fall:
+                on_fall(b)
+            return [((cost, cost), a), ((1, 1), b)]
+
+        if m in pic18.FILE_D:
+            addr = self.address(st, insn.f)
+            r = self.alu(st, m, self.read(st, addr), st.w)
+            dest = addr if insn.d else WREG
+            self.write(st, dest, r)
+            if m in ("decfsz", "incfsz", "dcfsnz", "infsnz"):
+                zero = None if r is None else r == 0
+                cond = zero if m in ("decfsz", "incfsz") else (None if zero is None else not zero)
+
+                def known_zero(s):
+                    self.write(s, dest, 0)
+
+                if m in ("decfsz", "incfsz"):
+                    return skip(cond, on_skip=known_zero)
+                return skip(cond, on_fall=known_zero)
+            st.pc = i + 1
+            return [((1, 1), st)]
+
+        if m in pic18.FILE_A:
+            addr = self.address(st, insn.f)
+            f = self.read(st, addr)
+            if m == "movwf":
+                self.write(st, addr, st.w)
+            elif m == "clrf":
+                self.write(st, addr, 0)
+                st.z = 1
+            elif m == "setf":
+                self.write(st, addr, 0xFF)
+            elif m == "negf":
+                self.write(st, addr, self.alu(st, m, f, None))
+            elif m == "mulwf":
+                pass  # PRODH:PRODL only
+            elif m == "tstfsz":
+                return skip(None if f is None else f == 0)
+            else:
+                w = st.w
+                if f is None or w is None:
+                    cond = None
+                elif m == "cpfseq":
+                    cond = f == w
+                elif m == "cpfsgt":
+                    cond = f > w
+                else:
+                    cond = f < w
+                return skip(cond)
+            st.pc = i + 1
+            return [((1, 1), st)]
+
+        if m in pic18.BIT:
+            addr = self.address(st, insn.f)
+            if m in ("btfsc", "btfss"):
+                b = self.bit(st, addr, insn.b)
+                return skip(None if b is None else (b == 0) == (m == "btfsc"))
+            if addr == STATUS:
+                flag = {STATUS_C: "c", STATUS_Z: "z", STATUS_N: "n"}.get(insn.b)
+                if flag:
+                    old = getattr(st, flag)
+                    setattr(st, flag, 1 if m == "bsf" else 0 if m == "bcf" else
+                            None if old is None else 1 - old)
+            else:
+                f = self.read(st, addr)
+                mask = 1 << insn.b
+                if f is not None:
+                    f = f | mask if m == "bsf" else f & ~mask if m == "bcf" else f ^ mask
+                self.write(st, addr, f)
+            st.pc = i + 1
+            return [((1, 1), st)]
+
+        if m in pic18.LITERAL:
+            if m == "movlw":
+                st.w = insn.k
+            elif m == "retlw":
+                st.w = insn.k
+                return [((2, 2), END)]
+            elif m in ("mullw", "movlb"):
+                pass
+            elif m == "sublw":
+                st.w = self.alu(st, m, insn.k, st.w)
+            else:
+                st.w = self.alu(st, m, st.w, insn.k)
+            st.pc = i + 1
+            return [((1, 1), st)]
+
+        if m == "movff":
+            v = self.read(st, self.address(st, insn.f))
+            self.write(st, self.address(st, insn.f2), v)
+            st.pc = i + 1
+            return [((2, 2), st)]
+        if m == "lfsr":
+            self.set_fsr(st, insn.f, insn.k)
+            st.pc = i + 1
+            return [((2, 2), st)]
+
+        if m in ("goto", "bra"):
+            st.pc = insn.target
+            return [((2, 2), st)]
+        if m in pic18.BRANCH:
+            flag, taken_on = BRANCH_ON[m]
+            flag = None if flag is None else getattr(st, flag)
+            cond = None if flag is None else flag == taken_on
+            if cond is not None:
+                st.pc = insn.target if cond else i + 1
+                return [((2, 2) if cond else (1, 1), st)]
+            a, b = st.copy(), st
+            a.pc, b.pc = insn.target, i + 1
+            return [((2, 2), a), ((1, 1), b)]
+        if m in ("call", "rcall"):
+            r = self.routine(insn.target)
+            if r.best is None and not r.why:
+                return []  # never comes back
+            if r.writes is None:
+                st.mem.clear()
+            else:
+                for a in r.writes:
+                    st.mem.pop(a, None)
+            self.writes[-1] = None if r.writes is None or self.writes[-1] is None \
+                else self.writes[-1] | r.writes
+            if r.worst == INF and self.why[-1] is None:
+                self.why[-1] = r.why or r.name
+            st.w = st.c = st.z = st.n = None
+            st.pc = i + 1
+            return [((2 + (r.best or 0), 2 + r.worst), st)]
+        if m in ("return", "retfie"):
+            return [((2, 2), END)]
+        if m == "reset":
+            return []
+        if m.startswith("tbl"):
+            st.pc = i + 1
+            return [((2, 2), st)]
+        if m == "daw":
+            st.w = None
+        st.pc = i + 1
+        return [((1, 1), st)]
+
+    # **** Exploration ****
+    def walk(self, st, lo, hi, first=False):
+        """
+        Runs st while there is only one way on. Returns (lo, hi, END, None)
+        when the routine is done, or (lo, hi, state, successors) at a branch.
+        """
+        steps = 0
+        # Brent's cycle detection over the states after backward jumps
+        saved = None
+        power = lam = 1
+        while True:
+            if st.pc == self.stop[-1] and not first:
+                return lo, hi, END, None
+            first = False
+            pc = st.pc
+            succ = self.step(st)
+            if len(succ) != 1:
+                return lo, hi, st, succ
+            (clo, chi), st = succ[0]
+            lo += clo
+            hi += chi
+            if st is END:
+                return lo, hi, END, None
+            if st.pc <= pc:
+                k = st.key()
+                if k == saved:
+                    # Loops forever, make it a node so explore sees the cycle
+                    return lo, hi, st, [((0, 0), st)]
+                if lam == power:
+                    saved = k
+                    power *= 2
+                    lam = 0
+                lam += 1
+            steps += 1
+            if steps > MAX_STEPS:
+                raise Unbounded(self.prog.name(self.where(st.pc)))
+
+    def where(self, pc):
+        """Instruction of the label pc is under"""
+        while pc > 0 and not self.prog.insns[pc].labels:
+            pc -= 1
+        return pc
+
+    def explore(self, entry, stop=None):
+        """(best, worst, why) from entry to a return, or to stop"""
+        self.stop.append(stop)
+        self.why.append(None)
+        try:
+            best, worst, why = self._explore(entry)
+            return best, worst, why or self.why[-1]
+        finally:
+            self.stop.pop()
+            self.why.pop()
+
+    def _explore(self, entry):
+        ROOT = "root"
+        graph = {}
+        todo = []
+
+        def follow(node_edges, cost, s, first=False):
+            lo, hi, s2, succ = self.walk(s, cost[0], cost[1], first)
+            if s2 is END:
+                node_edges.append((lo, hi, END))
+                return
+            k = s2.key()
+            node_edges.append((lo, hi, k))
+            if k not in graph and k not in pending:
+                pending[k] = s2.pc
+                todo.append((k, succ))
+
+        pending = {}
+        graph[ROOT] = []
+        follow(graph[ROOT], (0, 0), State(entry), first=True)
+        while todo:
+            k, succ = todo.pop()
+            edges = []
+            for cost, s in succ:
+                follow(edges, cost, s)
+            graph[k] = edges
+            if len(graph) > MAX_STATES:
+                raise Unbounded(self.prog.name(self.where(pending[k])))
+
+        # Best: shortest path to END
+        dist = {ROOT: 0}
+        heap = [(0, 0, ROOT)]
+        tie = 1
+        best = None
+        while heap:
+            d, _, k = heapq.heappop(heap)
+            if k == END:
+                best = d
+                break
+            if d > dist.get(k, INF):
+                continue
+            for lo, _hi, k2 in graph[k]:
+                if d + lo < dist.get(k2, INF):
+                    dist[k2] = d + lo
+                    heapq.heappush(heap, (d + lo, tie, k2))
+                    tie += 1
+        if best is None:
+            return None, INF, None
+
+        # Worst: longest path, unbounded if a cycle is reachable
+        worst = {}
+        state = {}
+        why = [None]
+
+        def longest(k):
+            if k == END:
+                return 0
+            if state.get(k) == 2:
+                return worst[k]
+            if state.get(k) == 1:
+                why[0] = self.prog.name(self.where(pending[k]))
+                return INF
+            state[k] = 1
+            w = -INF
+            for _lo, hi, k2 in graph[k]:
+                w = max(w, hi + longest(k2))
+            state[k] = 2
+            worst[k] = w
+            return w
+
+        sys.setrecursionlimit(max(sys.getrecursionlimit(), 4 * len(graph) + 1000))
+        w = longest(ROOT)
+        return best, w, why[0]
+
+    def routine(self, entry):
+        """Result of the routine at instruction index entry"""
+        if entry in self.results:
+            return self.results[entry]
+        name = self.prog.name(entry)
+        if entry in self.active:
+            raise pic18.AsmError("%s is recursive" % name)
+        self.active.add(entry)
+        self.writes.append(set())
+        try:
+            best, worst, why = self.explore(entry)
+        except Unbounded as e:
+            best, worst, why = None, INF, str(e)
+            self.writes[-1] = None  # not all of it was seen
+        writes = self.writes.pop()
+        self.active.discard(entry)
+        r = Result(name, best, worst, writes, why)
+        self.results[entry] = r
+        return r
+
+    def loop(self, label):
+        """Result of one pass of the loop at label"""
+        entry = self.prog.at(label)
+        self.writes.append(set())
+        try:
+            best, worst, why = self.explore(entry, stop=entry)
+        except Unbounded as e:
+            best, worst, why = None, INF, str(e)
+        return Result(label + " pass", best, worst, self.writes.pop(), why)
+
+
+def analyze(prog, loops):
+    """Results of the ISRs, the other routines and then the loop passes"""
+    a = Analyzer(prog)
+    start = prog.labels.get(prog.start)
+    isrs = []
+    entries = []
+    for _psect, i in prog.vectors:
+        insn = prog.insns[i]
+        target = insn.target if insn.mnem in ("goto", "bra") else i
+        if i == start:
+            entries.append(target)
+        else:
+            isrs.append(target)
+    for insn in prog.insns:
+        if insn.mnem in ("call", "rcall") and insn.target not in entries + isrs:
+            entries.append(insn.target)
+
+    # What an ISR writes can change under the rest of the code. The ISRs are
+    # not interrupted themselves, the routines they call are analyzed again.
+    results = [a.routine(i) for i in isrs]
+    for r in results:
+        a.volatile |= set(range(0x1000)) if r.writes is None else r.writes
+    a.results = {}
+    results += [a.routine(i) for i in sorted(entries, key=lambda i: prog.insns[i].addr)]
+    results += [a.loop(label) for label in loops]
+    return results
+
+
+def read_budget(path):
+    budget = {}
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            line = line.split("#", 1)[0].split()
+            if not line:
+                continue
+            if len(line) != 2:
+                raise pic18.AsmError("%s:%d: expected a name and cycles" % (path, n))
+            budget[line[0]] = int(line[1])
+    return budget
+
+
+def fmt(v):
+    return "-" if v is None else "unbounded" if v == INF else str(v)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Best and worst case cycles of PIC18 routines")
+    ap.add_argument("-f", type=float, default=1.0, metavar="MHz", help="instruction clock (default 1)")
+    ap.add_argument("-l", action="append", default=[], metavar="label", help="loop to report one pass of")
+    ap.add_argument("-b", metavar="budget", help="file of name and worst case cycles allowed")
+    ap.add_argument("source")
+    args = ap.parse_args()
+
+    try:
+        prog = pic18.read(args.source)
+        results = analyze(prog, args.l)
+        budget = read_budget(args.b) if args.b else {}
+    except pic18.AsmError as e:
+        print("wcet: %s" % e, file=sys.stderr)
+        return 2
+
+    failed = 0
+    print("%-22s %10s %10s %12s %8s" % ("routine", "best", "worst", "worst us", "budget"))
+    for r in results:
+        us = "-" if r.worst == INF or r.best is None else "%.1f" % (r.worst / args.f)
+        limit = budget.pop(r.name.replace(" pass", ""), None)
+        status = ""
+        if limit is not None:
+            over = r.best is None or r.worst > limit
+            failed += over
+            status = "%d%s" % (limit, " OVER" if over else "")
+        worst = "no return" if r.best is None and not r.why else fmt(r.worst)
+        print("%-22s %10s %10s %12s %8s" % (r.name, fmt(r.best), worst, us, status))
+        if r.worst == INF and r.why:
+            print("%22s   waits in %s" % ("", r.why))
+    for name in budget:
+        print("wcet: %s is in the budget but not in %s" % (name, args.source), file=sys.stderr)
+        failed += 1
+    if failed:
+        print("wcet: %d over budget" % failed, file=sys.stderr)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
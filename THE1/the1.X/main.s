@@ -24,68 +24,135 @@ CONFIG DEBUG = OFF      ; Disable In-Circuit Debugger
 
 
 
-GLOBAL var1
-GLOBAL var2
-GLOBAL var3
-GLOBAL counter1
-GLOBAL counter2
-GLOBAL previousRe0
-GLOBAL currentRe0
-GLOBAL previousRe1
-GLOBAL currentRe1
-GLOBAL progressC_enabled
-GLOBAL progressB_enabled
-GLOBAL progressC_current
-GLOBAL progressB_current
+GLOBAL events
+GLOBAL t0_overflows
+GLOBAL t0_low
+GLOBAL buttons_now
+GLOBAL buttons_prev
+GLOBAL released
+GLOBAL pending
+GLOBAL bars
+GLOBAL barB
+GLOBAL barC
+GLOBAL bars_left
+GLOBAL bar_flags
+GLOBAL bar_next
+
+; Timebase: Timer0 counts instruction cycles with no prescaler and
+; overflows every T0_PERIOD of them, 5 ms at the 1 MHz instruction clock the
+; tests simulate (50000 on the board's 10 MHz one). The buttons are sampled
+; on every overflow and T0_OVERFLOWS overflows make one 500 ms step.
+T0_PERIOD EQU 5000
+T0_OVERFLOWS EQU 100
+T0_START EQU 65536 - T0_PERIOD
+; The ISR adds T0_RELOAD to the running counter instead of overwriting it,
+; so the interrupt latency does not stretch the period. The 7 cycles from
+; reading TMR0L to writing it and the 2 cycles a write stops the count for
+; are added back.
+T0_RELOAD EQU T0_START + 9
+
+; Bits of events, set by the ISR and cleared by the main loop
+EV_STEP EQU 0 ; a 500 ms step is due
+
+; Buttons on PORTE, each one toggles a progress bar when released
+BUTTONS EQU 00000011B ; RE0 toggles PORTC, RE1 toggles PORTB
+
+; Progress bar descriptor, BAR_SIZE bytes each, see update_bars
+BAR_LAT EQU 0 ; Low byte of the LAT address, the high byte is 0Fh
+BAR_FLAGS EQU 1
+BAR_VALUE EQU 2 ; The current value of the progress bar
+BAR_SIZE EQU 3
+; Bits of BAR_FLAGS
+BAR_ENABLED EQU 0 ; 1 if the progress bar is enabled, 0 if disabled
+BAR_DOWN EQU 1 ; 1 fills from bit 7 down, 0 from bit 0 up
+BAR_COUNT EQU 2
     
 ; Define space for the variables in RAM
 PSECT udata_acs
-var1:
-    DS 1 ; Allocate 1 byte for var1
-var2:
-    DS 1 
-var3:
-    DS 1
-previousRe0:
-    DS 1
-currentRe0:
-    DS 1
-previousRe1:
-    DS 1
-currentRe1:
-    DS 1
-counter1:
-    DS 1 
-counter2:
-    DS 1  
-progressC_enabled:
-    DS 1 ; 1 if the progress bar on PORTC is enabled, 0 if disabled
-progressB_enabled:
-    DS 1
-progressC_current:
-    DS 1 ; The current value of the progress bar on PORTC
-progressB_current:
-    DS 1 ; The current value of the progress bar on PORTB
+events:
+    DS 1 ; Allocate 1 byte for events
+t0_overflows:
+    DS 1 ; Timer0 overflows left in the current step
+t0_low:
+    DS 1 ; Low byte of the reloaded Timer0, ISR only
+buttons_now:
+    DS 1 ; BUTTONS of PORTE at this overflow, ISR only
+buttons_prev:
+    DS 1 ; BUTTONS of PORTE at the previous overflow, ISR only
+released:
+    DS 1 ; Buttons released since the main loop last looked, set by the ISR
+pending:
+    DS 1 ; The released buttons the main loop is handling
+bars: ; BAR_COUNT descriptors, in the order update_bars walks them
+barB:
+    DS BAR_SIZE ; The progress bar on PORTB
+barC:
+    DS BAR_SIZE ; The progress bar on PORTC
+bars_left:
+    DS 1 ; Descriptors update_bars has not walked yet
+bar_flags:
+    DS 1 ; BAR_FLAGS of the bar update_bars is at
+bar_next:
+    DS 1 ; Next value of the bar update_bars is at
 
 PSECT resetVec,class=CODE,reloc=2
 resetVec:
     goto       main
 
+; High priority interrupt vector, the only one used (IPEN = 0)
+PSECT hiIntVec,class=CODE,reloc=2
+hiIntVec:
+    goto       timer_isr
+
 PSECT CODE
+; Timer0 overflow, the only interrupt enabled
+timer_isr:
+    bcf INTCON, 2 ; Clear TMR0IF
+
+    ; TMR0 += T0_RELOAD. Reading TMR0L latches TMR0H, writing TMR0L loads
+    ; TMR0H from what was written to it. 7 cycles from the read to the write.
+    movf TMR0L, W ; Cycle 0, TMR0 is the cycles since the overflow
+    addlw low(T0_RELOAD)
+    movwf t0_low
+    movlw high(T0_RELOAD)
+    addwfc TMR0H, W ; Latched high byte plus the carry of the low one
+    movwf TMR0H
+    movf t0_low, W
+    movwf TMR0L ; Cycle 7
+
+    ; Sample the buttons, 5ms apart is enough to debounce them
+    movf PORTE, W
+    andlw BUTTONS
+    movwf buttons_now
+    comf buttons_now, W ; Low now
+    andwf buttons_prev, W ; and high 5ms ago: released
+    iorwf released, F
+    movff buttons_now, buttons_prev
+
+    decfsz t0_overflows ; Skip if this overflow ends the step
+    retfie 1 ; Fast return restores W, STATUS and BSR
+    movlw T0_OVERFLOWS
+    movwf t0_overflows
+    bsf events, EV_STEP
+    retfie 1
+
 main:
-    clrf var1 ; set every bit in var1 to 0
-    clrf var2	
-    clrf var3	
-    clrf previousRe0
-    clrf currentRe0
-    clrf previousRe1
-    clrf currentRe1
-    clrf counter1
-    clrf counter2
-    clrf progressC_enabled
-    clrf progressB_enabled
-    clrf progressC_current
-    clrf progressB_current
+    clrf events ; set every bit in events to 0
+    clrf buttons_now
+    clrf buttons_prev
+    clrf released
+    clrf pending
+
+    ; PORTB fills up from RB0, PORTC down from RC7, both start disabled
+    movlw low(LATB)
+    movwf barB + BAR_LAT
+    clrf barB + BAR_FLAGS
+    clrf barB + BAR_VALUE
+    movlw low(LATC)
+    movwf barC + BAR_LAT
+    movlw 1 << BAR_DOWN
+    movwf barC + BAR_FLAGS
+    clrf barC + BAR_VALUE
     
     ; PORTB
     ; LATB
@@ -100,187 +167,106 @@ main:
     setf LATC ; light up all pins in PORTC
     setf LATD
     
-    call busy_wait
+    call init_timebase
+    call wait_step ; 1000ms is two steps
+    call wait_step
     
     clrf PORTB
     clrf LATC ; turn off all pins in PORTC
     clrf LATD
     
-    movlw 50 ; wreg = 50
-    movwf counter1 ; counter1 = 50
-    movlw 50 ; wreg = 50
-    movwf counter2 ; counter2 = 50
-    
 main_loop:
-    ; Round robin approach
-    call check_buttons
+    ; Handle the buttons the ISR saw released, update the display when it says
+    ; a step is due
+    call handle_buttons
+    btfss events, EV_STEP ; Skip next instruction if a step is due
+    goto main_loop
+    bcf events, EV_STEP
     call update_display
     goto main_loop
+
+; Subroutine to start Timer0 and its interrupt, the first step ends 500ms later
+init_timebase:
+    movlw T0_OVERFLOWS
+    movwf t0_overflows
+    ; 16-bit mode first, T0CON resets to 8-bit where TMR0H is not loaded
+    movlw 00001000B ; Stopped, 16-bit, internal clock, no prescaler
+    movwf T0CON
+    movlw high(T0_START)
+    movwf TMR0H ; Buffered until TMR0L is written
+    movlw low(T0_START)
+    movwf TMR0L
+    bsf T0CON, 7 ; TMR0ON
+    bcf RCON, 7 ; IPEN = 0, every interrupt is high priority
+    clrf INTCON ; Clear the flags and disable the other interrupts
+    bsf INTCON, 5 ; TMR0IE
+    bsf INTCON, 7 ; GIE
+    return
+
+; Subroutine to wait until the ISR says a step is due, and take the step
+wait_step:
+    btfss events, EV_STEP ; Skip next instruction if a step is due
+    bra wait_step
+    bcf events, EV_STEP
+    return
     
-; Subroutine to check the button states
-check_buttons:
-    call check_Re0
-    call check_Re1
+; Subroutine to toggle the progress bars of the released buttons
+handle_buttons:
+    movf released, W
+    xorwf released, F ; Clear the bits just read, not those the ISR sets after
+    movwf pending
+    btfsc pending, 0 ; Skip next step if RE0 was not released
+    btg barC + BAR_FLAGS, BAR_ENABLED ; bit toggle file
+    btfsc pending, 1 ; Skip next step if RE1 was not released
+    btg barB + BAR_FLAGS, BAR_ENABLED
     return
     
-; Subroutine to update the progress bar display on ports
+; Subroutine to update the progress bar display on ports, once every 500ms step
 update_display:
-    ; Check counter1 and counter2 to check 500ms is passed
-    decfsz counter1 ; decrease counter1, if it is 0, skip next instruction
-    goto update_display_end ; if counter1 != 0, branch to update_display_end
-    decfsz counter2 ; decrease counter2, if it is 0, skip next instruction
-    goto update_display_end ; if counter2 != 0, branch to update_display_end
-
-    ; 500ms has passed, reset the counters
-    movlw 50 ; wreg = 50
-    movwf counter1 ; counter1 = 50
-    movlw 50 ; wreg = 50
-    movwf counter2 ; counter2 = 50
-
     ; Toggle RD0
     ; To toggle, we use xorwf with a mask that has a '1' for the bit we want to toggle
     movlw 0x01 ; Load the mask for RD0
     xorwf LATD, F ; Toggle RD0 by performing an exclusive OR on the current value of LATD
     
-    ; Update the progress bar on PORTB  
-    btfsc progressB_enabled, 0 ; Skip next step if progress bar on PORTB is not enabled
-    call update_portB_progress ; Call subroutine to update PORTB's progress bar
-    btfss progressB_enabled, 0 ; Skip next step if progress bar on PORTB is enabled
-    clrf LATB ; Clear the progress bar on PORTB
-    btfss progressB_enabled, 0 ; Skip next step if progress bar on PORTB is enabled
-    clrf progressB_current ; Clear the progress bar status of PORTB
-    
-    ; Update the progress bar on PORTC  
-    btfsc progressC_enabled, 0 ; Skip next step if progress bar on PORTC is not enabled
-    call update_portC_progress ; Call subroutine to update PORTC's progress bar
-    btfss progressC_enabled, 0 ; Skip next step if progress bar on PORTC is enabled
-    clrf LATC ; Clear the progress bar on PORTB
-    btfss progressC_enabled, 0 ; Skip next step if progress bar on PORTC is enabled
-    clrf progressC_current ; Clear the progress bar status of PORTC
-
-    update_display_end:
-        return
-	
-; Subroutine to update progress bar on PORTB, start from 0th bit light everything until all of them are on, then clear and repeat
-update_portB_progress:
-    ; Check if the progress bar is full
-    movlw 0xFF ; Load the mask for all bits set
-    cpfseq LATB ; Compare the mask with the current value of LATB
-    goto increment_progressB ; If they are equal, branch to increment_progressB
-    
-    ; The progress bar is full so clear it
-    clrf LATB ; Clear the progress counter
-    clrf progressB_current 
+    call update_bars
     return
 
-increment_progressB:
-    ; Left shift and increment the progress counter
-    rlncf progressB_current ; Rotate left no carry 
-    incf progressB_current ; Increment the progress counter
-    
-    ; Update the progress bar
-    movf progressB_current, W ; Move the progress counter to Wreg
-    movwf LATB ; Move the progress counter to LATB
-    
-    return 
-    
-; Subroutine to update progress bar on PORTC, start from 0th bit light everything until all of them are on, then clear and repeat
-update_portC_progress:
-    ; Check if the progress bar is full
-    movlw 0xFF ; Load the mask for all bits set
-    cpfseq LATC ; Compare the mask with the current value of LATC
-    goto increment_progressC ; If they are equal, branch to increment_progressC
-    
-    ; The progress bar is full so clear it
-    clrf LATC ; Clear the progress counter
-    clrf progressC_current
-    return
-
-increment_progressC:
-    ; Right shift and add 128 to the progress counter
-    rrncf progressC_current ; Rotate right no carry
-    movf progressC_current, W ; Move the progress counter to Wreg
-    addlw 128 ; Add 128 to Wreg
-    movwf progressC_current ; Move the result back to the progress counter
-    
-    ; Update the progress bar
-    movf progressC_current, W ; Move the progress counter to Wreg
-    movwf LATC ; Move the Wreg to LATC
-    
-    return 
-    
-check_Re0:
-    ; Read the current state of PORTE into 'current'
-    movf PORTE, W ; move input in PORTE to Wreg
-    movwf currentRe0
-
-    ; Check for RE0 release
-    btfsc currentRe0, 0     ; Check if RE0 is currently high, bit test file, skip if clear
-    bsf previousRe0, 0      ; If it is high, set the corresponding bit in 'previous', bit set file
-    btfss currentRe0, 0     ; Check if RE0 is currently low, bit test file, skip if set
-    call re0_pressed	    ; If it is low, call the re0_pressed subroutine, relative call
-    
-    return
-
-; Subroutine to handle RE0 button press
-re0_pressed:
-    ; Check if RE0 was previously high (1)
-    btfss previousRe0, 0 ; bit test file, skip if set
-    return ; Return if it was not high, meaning we have already handled the press
-    
-    ; Read the current state of progressC_enabled
-    movf progressC_enabled, W ; Move progressC_enabled to W
-    xorlw 0x01 ; Toggle the bit in W (if 0 becomes 1, if 1 becomes 0)
-    movwf progressC_enabled ; Move the toggled state back to progressC_enabled
-
-    ; Clear the bit in 'previous' to indicate we have handled the press
-    bcf previousRe0, 0 ; bit clear file
-    return
-    
-check_Re1:
-    ; Read the current state of PORTE into 'currentRe1'
-    movf PORTE, W ; move input in PORTE to wreg
-    movwf currentRe1 ; move wreg to currentRe1
+; Subroutine to advance every progress bar one step, start from the first bit
+; light everything until all of them are on, then clear and repeat. A disabled
+; bar is cleared. Every path through the loop takes the same time: 22 cycles
+; per bar, 21 for the last one, plus 10 for the call, the setup and the return.
+update_bars:
+    lfsr 0, bars ; FSR0 walks the descriptors
+    lfsr 1, LATB ; FSR1H is 0Fh for every LAT, FSR1L comes from BAR_LAT
+    movlw BAR_COUNT
+    movwf bars_left
 
-    ; Check for RE1 release
-    btfsc currentRe1, 1     ; Check if RE1 is currently high
-    bsf previousRe1, 0      ; If it is high, set the corresponding bit in 'previousRe1'
-    btfss currentRe1, 1     ; Check if RE1 is currently low
-    call re1_pressed       ; If it is low, call the re1_pressed subroutine
+bar_loop:
+    movff POSTINC0, FSR1L ; BAR_LAT
+    movff POSTINC0, bar_flags ; BAR_FLAGS, FSR0 is left at BAR_VALUE
 
-    return
-    
-; Subroutine to handle RE1 button press
-re1_pressed:
-    ; Check if RE1 was previously high (1)
-    btfss previousRe1, 0 ; bit test file, skip if set, if previousRe1's 0th bit is 1, skip next instruction
-    return ; Return if it was not high, meaning we have already handled the press
+    ; Fill up: left shift and set bit 0
+    rlncf INDF0, W ; Rotate left no carry
+    iorlw 00000001B
+    ; Fill down: right shift and set bit 7, same as adding 128
+    btfsc bar_flags, BAR_DOWN ; Skip next step if the bar fills up
+    rrncf INDF0, W ; Rotate right no carry
+    btfsc bar_flags, BAR_DOWN
+    iorlw 10000000B
+    movwf bar_next
 
-    ; Read the current state of progressB_enabled
-    movf progressB_enabled, W ; Move progressB_enabled to W
-    xorlw 0x01 ; Toggle the bit in W (if 0 becomes 1, if 1 becomes 0)
-    movwf progressB_enabled ; Move the toggled state back to progressB_enabled
+    ; The progress bar is full or disabled so clear it
+    incf INDF0, W ; Z is set if all bits were set
+    btfsc STATUS, 2 ; Skip next step if Z is clear
+    clrf bar_next
+    btfss bar_flags, BAR_ENABLED ; Skip next step if the bar is enabled
+    clrf bar_next
 
-    ; Clear the bit in 'previous' to indicate we have handled the press
-    bcf previousRe1, 0 ; bit clear file, clear the 0th bit in previousRe1
+    movf bar_next, W
+    movwf POSTINC0 ; BAR_VALUE, FSR0 moves on to the next descriptor
+    movwf INDF1 ; LAT of the bar
+    decfsz bars_left ; Skip next instruction after the last bar
+    bra bar_loop
     return
 
-; Subroutine to busy wait for 1000ms
-busy_wait:
-    movlw 250 ; wreg = 250
-    movwf var2 ; var2 = 250
-    movlw 230 ; wreg = 230
-    movwf var1 ; var1 = 230
-    outer_loop_start:
-        loop_start:
-            setf var3 ; set all bits in var3 to 1
-            inner_loop_start:
-                decf var3 ; var3--
-                bnz inner_loop_start ; if var3 != 0, branch to inner_loop_start
-            incfsz var1 ; increase var1, if it is 0, skip next instruction
-            bra loop_start ; branch to loop_start
-        incfsz var2 ; increase var2, if it is 0, skip next instruction
-        bra outer_loop_start ; branch to outer_loop_start
-    return
-     
 end resetVec
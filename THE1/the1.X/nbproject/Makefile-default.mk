@@ -120,13 +120,13 @@ dist/${CND_CONF}/${IMAGE_TYPE}/the1.X.${IMAGE_TYPE}.${OUTPUT_SUFFIX}: ${OBJECTFI
 	@${MKDIR} dist/${CND_CONF}/${IMAGE_TYPE} 
 	${MP_LD} -mcpu=PIC18F8722 ${OBJECTFILES_QUOTED_IF_SPACED} \
 	-o dist/${CND_CONF}/${IMAGE_TYPE}/the1.X.${IMAGE_TYPE}.${OUTPUT_SUFFIX} \
-	 -misa=std -msummary=+mem,-psect,-class,-hex,-file,-sha1,-sha256,-xml,-xmlfull -mcallgraph=std -mno-download-hex
+	 -misa=std -msummary=+mem,-psect,-class,-hex,-file,-sha1,-sha256,-xml,-xmlfull -mcallgraph=std -mno-download-hex -Wl,-presetVec=0h,-phiIntVec=08h
 else
 dist/${CND_CONF}/${IMAGE_TYPE}/the1.X.${IMAGE_TYPE}.${OUTPUT_SUFFIX}: ${OBJECTFILES}  nbproject/Makefile-${CND_CONF}.mk   
 	@${MKDIR} dist/${CND_CONF}/${IMAGE_TYPE} 
 	${MP_LD} -mcpu=PIC18F8722 ${OBJECTFILES_QUOTED_IF_SPACED} \
 	-o dist/${CND_CONF}/${IMAGE_TYPE}/the1.X.${IMAGE_TYPE}.${OUTPUT_SUFFIX} \
-	 -misa=std -msummary=+mem,-psect,-class,-hex,-file,-sha1,-sha256,-xml,-xmlfull -mcallgraph=std -mno-download-hex
+	 -misa=std -msummary=+mem,-psect,-class,-hex,-file,-sha1,-sha256,-xml,-xmlfull -mcallgraph=std -mno-download-hex -Wl,-presetVec=0h,-phiIntVec=08h
 endif
 
 
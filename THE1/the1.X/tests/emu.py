@@ -0,0 +1,173 @@
+"""
+Stand-in for the MdbTester of mdb.py that runs the tests on the PIC18F8722
+emulator in ../host/emu.c instead of the MPLAB simulator. It has the calls
+test.py and grading.record_output make: watch, get, run_timeout,
+stopwatch, clear_breakpoints, stim and run.
+
+The program is an Intel hex file, the one MPLAB builds or the one
+`make emu` assembles from main.s into ../host/build/main.hex. The
+instruction clock is 1 MHz, as in the mdb prelude of test.py, so one cycle
+is 1 us of stimulus time.
+"""
+
+import ctypes
+import os
+import re
+import sys
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+HOST = os.path.join(HERE, "..", "host")
+LIBRARY = os.path.join(HOST, "build", "libpic18emu.so")
+DEFAULT_HEX = os.path.join(HOST, "build", "main.hex")
+
+sys.path.insert(0, HOST)
+from pic18 import SFR  # noqa: E402
+
+CYCLES_PER_MS = 1000
+# run_timeout gives up after this many cycles without a watched write
+TIMEOUT = 2000 * CYCLES_PER_MS
+
+PORTS = "ABCDEFGHJ"
+
+# Statements of the stimulus files: "RE1 <= '1';", "wait for 10 ms;" and
+# the final "wait;"
+_STATEMENT = re.compile(
+    r"\bR([A-HJ])([0-7])\s*<=\s*'([01])'\s*;"
+    r"|\bwait\s+for\s+(\d+(?:\.\d+)?)\s*(s|ms|us|ns)\s*;"
+    r"|\bwait\s*;", re.I)
+_UNIT = {"s": 1e6, "ms": 1e3, "us": 1.0, "ns": 1e-3}
+
+
+class EmuError(Exception):
+    pass
+
+
+def read_stimulus(path):
+    """[(cycles from the start, port index, bit, level)] of a .scl file"""
+    with open(path) as f:
+        text = re.sub(r"--[^\n]*", "", f.read())
+    events = []
+    t = 0
+    for m in _STATEMENT.finditer(text):
+        if m.group(1):
+            events.append((t, PORTS.index(m.group(1).upper()), int(m.group(2)), int(m.group(3))))
+        elif m.group(4):
+            t += int(round(float(m.group(4)) * _UNIT[m.group(5).lower()] * CYCLES_PER_MS / 1e3))
+        else:
+            break
+    return events
+
+
+def _load_library(path):
+    lib = ctypes.CDLL(path)
+    lib.emu_new.restype = ctypes.c_void_p
+    lib.emu_free.argtypes = [ctypes.c_void_p]
+    lib.emu_reset.argtypes = [ctypes.c_void_p]
+    lib.emu_load_hex.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+    lib.emu_run.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+    lib.emu_cycles.argtypes = [ctypes.c_void_p]
+    lib.emu_cycles.restype = ctypes.c_uint64
+    lib.emu_pc.argtypes = [ctypes.c_void_p]
+    lib.emu_pc.restype = ctypes.c_uint32
+    lib.emu_error.argtypes = [ctypes.c_void_p]
+    lib.emu_error.restype = ctypes.c_char_p
+    lib.emu_peek.argtypes = [ctypes.c_void_p, ctypes.c_uint]
+    lib.emu_watch.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.c_int]
+    lib.emu_clear_watches.argtypes = [ctypes.c_void_p]
+    lib.emu_set_pin.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+    return lib
+
+
+class EmuTester:
+    def __init__(self, hexfile=DEFAULT_HEX, breakpoints=(), library=LIBRARY):
+        if not os.path.exists(library):
+            raise EmuError("%s not built, run make emu" % library)
+        self.lib = _load_library(library)
+        self.hexfile = hexfile
+        self.emu = self.lib.emu_new()
+        if not self.emu:
+            raise EmuError("out of memory")
+        if self.lib.emu_load_hex(self.emu, hexfile.encode()) != 0:
+            raise EmuError(self.lib.emu_error(self.emu).decode())
+        if breakpoints:
+            raise EmuError("the emulator has no code breakpoints, the hex file has no symbols")
+        self.stimulus = []
+        self.last_stop = 0
+
+    def __del__(self):
+        if getattr(self, "emu", None):
+            self.lib.emu_free(self.emu)
+            self.emu = None
+
+    def _address(self, reg):
+        if reg not in SFR:
+            raise EmuError("unknown register %s" % reg)
+        return SFR[reg]
+
+    def cycles(self):
+        return self.lib.emu_cycles(self.emu)
+
+    def reset(self):
+        """Power-on reset, with no stimulus, watches or stopwatch time"""
+        self.lib.emu_reset(self.emu)
+        self.lib.emu_clear_watches(self.emu)
+        self.stimulus = []
+        self.last_stop = 0
+
+    def watch(self, spec):
+        """Stops run_timeout after a write to a register: "PORTB W" """
+        reg, _, access = spec.partition(" ")
+        if access.strip().upper() not in ("", "W"):
+            raise EmuError("only write watches are emulated: %s" % spec)
+        self.lib.emu_watch(self.emu, self._address(reg), 1)
+
+    def clear_breakpoints(self):
+        self.lib.emu_clear_watches(self.emu)
+
+    def get(self, reg):
+        return self.lib.emu_peek(self.emu, self._address(reg))
+
+    def stim(self, path):
+        """Replaces the stimulus with a .scl file, starting now"""
+        now = self.cycles()
+        self.stimulus = [(now + t, port, bit, level) for t, port, bit, level in read_stimulus(path)]
+
+    def stopwatch(self):
+        """Cycles since the previous call, or the reset"""
+        now = self.cycles()
+        elapsed = now - self.last_stop
+        self.last_stop = now
+        return elapsed
+
+    def run_timeout(self, cycles=TIMEOUT):
+        """Runs until a watched write, True, or cycles without one, False"""
+        deadline = self.cycles() + cycles
+        while True:
+            now = self.cycles()
+            while self.stimulus and self.stimulus[0][0] <= now:
+                _, port, bit, level = self.stimulus.pop(0)
+                self.lib.emu_set_pin(self.emu, port, bit, level)
+            if now >= deadline:
+                return False
+            until = min(deadline, self.stimulus[0][0]) if self.stimulus else deadline
+            r = self.lib.emu_run(self.emu, until - now)
+            if r < 0:
+                raise EmuError(self.lib.emu_error(self.emu).decode())
+            if r == 1:
+                return True
+
+    def run(self, tests):
+        """Runs every test from a reset, like MdbTester.run"""
+        total_cycles = 0
+        total_wall = 0.0
+        for test in tests:
+            self.reset()
+            print("Running", test.__name__, "on", os.path.basename(self.hexfile))
+            start = time.perf_counter()
+            test(self, {}, {})
+            wall = time.perf_counter() - start
+            total_cycles += self.cycles()
+            total_wall += wall
+            print("%s: %.3f s simulated in %.1f ms" % (test.__name__, self.cycles() / 1e6, wall * 1e3))
+        print("All tests: %.3f s simulated in %.1f ms" % (total_cycles / 1e6, total_wall * 1e3))
@@ -47,6 +47,8 @@ FPS = SETTINGS["FPS"]
 PORT = SETTINGS["PORT"]
 BAUDRATE = SETTINGS["BAUDRATE"]
 LOG_LEVEL = SETTINGS["LOG_LEVEL"]
+# "ascii" or "binary", binary framing is requested with the GoCommand
+FRAMING = SETTINGS.get("FRAMING", "ascii")
 WAITING = 0
 GETTING = 1
 timeout = 100
@@ -73,6 +75,7 @@ class AutoPilot:
         self.reader_thread.daemon = True
         self.reader_thread.start()
         self.cmd_buffer = CMDBuffer()
+        self.binary = False
         self.cmd_queue = CommandQueue(CMD_GET_TIMEOUT)
 
         # Writer
@@ -110,6 +113,17 @@ class AutoPilot:
                 elif cmd_type == AltitudeCommand:
                     logging.info(f"Altitude report: {cmd.altitude}")
                     self.screen.set_altitude(cmd.altitude)
+                elif cmd_type == StatsCommand:
+                    # Telemetry only, not part of the graded periodic output
+                    if cmd.count:
+                        logging.info(
+                            f"Stats report: {cmd.probe_name()} calls {cmd.count} min {cmd.min} max {cmd.max} mean {cmd.mean():.1f} cycles")
+                    else:
+                        logging.info(f"Stats report: {cmd.probe_name()} not hit")
+                    continue
+                elif cmd_type == IdleCommand:
+                    logging.info(f"Idle report: {cmd.idle}%")
+                    continue
                 else:
                     # TODO
                     # logging.warning(
@@ -136,13 +150,24 @@ class AutoPilot:
         logging.debug(f"Writing '{str(message)}'")
         with self.writer_lock:
             if issubclass(type(message), Command):
-                self.serial.write(message.make_bytes())
+                self.serial.write(message.make_bytes(self.binary))
             elif type(message) == bytes:
                 self.serial.write(message)
             else:
                 logging.error(
                     f"Write has received message of unknown type {type(message)}")
 
+    def send_go(self, total_distance: int):
+        """
+        Sends the GoCommand, negotiating binary framing if FRAMING asks for it.
+        The plane only starts reporting after GOO/GOB, so the reader can be
+        switched before the command is written.
+        """
+        binary = FRAMING == "binary"
+        self.cmd_buffer.set_binary(binary)
+        self.write(GoCommand(total_distance, binary))
+        self.binary = binary
+
     def update_screen(self, update: object):
         self.screen.update(update)
 
@@ -171,7 +196,7 @@ class AutoPilot:
         logging.info(f"Demo sends GoCommand")
         self.start_time = time.time()
         self.cmd_queue.set_start_time(self.start_time)
-        self.write(GoCommand(total_distance))
+        self.send_go(total_distance)
         self.write(AltitudeCommand(AltitudePeriod.ALT_400))
         # time.sleep(period)
         self.cmd_queue.get()
@@ -214,7 +239,7 @@ class AutoPilot:
         TESTCASE["go-time"] = self.start_time
         self.update_screen({"TESTCASE": TESTCASE})
         self.cmd_queue.set_start_time(TESTCASE["go-time"])
-        self.write(GoCommand(TESTCASE["total-distance"]))
+        self.send_go(TESTCASE["total-distance"])
         # Create and setup agents
         cmd_dispatcher = CommandDispatcherAgent(self.cmd_queue, TESTCASE, self)
         periodicity_agent: PeriodicityAgent = self.setup_periodicity_agent(
@@ -8,6 +8,28 @@ CMD_END_BYTE = b'#'
 CMD_START_INT = int.from_bytes(CMD_START_BYTE, byteorder="little")
 CMD_END_INT = int.from_bytes(CMD_END_BYTE, byteorder="little")
 
+# Binary framing, negotiated by sending GoCommand(..., binary=True) ($GOB....#).
+# From then on every frame is BIN_SOF, payload length, opcode and the raw
+# little-endian payload.
+BIN_SOF = 0xA5
+BIN_HEADER_SIZE = 3  # BIN_SOF + length + opcode
+
+
+class Opcode(IntEnum):
+    """
+    Binary frame opcodes, the firmware's command_type_t values
+    """
+    GOO = 0
+    END = 1
+    SPD = 2
+    ALT = 3
+    MAN = 4
+    LED = 5
+    DST = 6
+    PRS = 7
+    STA = 8
+    IDL = 9
+
 
 class AltitudePeriod(IntEnum):
     """
@@ -49,24 +71,49 @@ class CommandID:
     DISTANCE_MSG_ID = b"DST"
     ALTITUDE_MSG_ID = b"ALT"
     PRESS_MSG_ID = b"PRS"
+    STATS_MSG_ID = b"STA"  # profiling counters, firmware built with PROFILE
+    IDLE_MSG_ID = b"IDL"  # idle time percentage, firmware built with PROFILE
     # AutoPilot CMD IDs
     LED_MSG_ID = b"LED"
     FUEL_MSG_ID = b"FUE"
     TURBULENCE_MSG_ID = b"TUR"  # MAX ALTITUDE and MAX SPEED
     ALTITUDE_FREQ_MSG_ID = b"FRE"
     GO_MSG_ID = b"GOO"  # total distance
+    GO_BINARY_MSG_ID = b"GOB"  # total distance, switches to binary framing
     END_MSG_ID = b"END"
     MANUAL_MSG_ID = b"MAN"
 
 
 class Command:
     MSG_ID = None
+    OPCODE = None
+    PAYLOAD_SIZE = 0
+    """
+    Binary payload size in bytes
+    """
+
+    def make_bytes(self, binary: bool = False):
+        if binary:
+            return self._make_binary_bytes()
+        return self._make_bytes()
 
-    def make_bytes(self):
+    def _make_bytes(self):
         raise Exception("Not implemented")
 
+    def _payload(self) -> int:
+        """
+        To be overriden by subclass. Value carried in the binary payload.
+        """
+        return 0
+
+    def _make_binary_bytes(self):
+        return (bytes((BIN_SOF, self.PAYLOAD_SIZE, self.OPCODE))
+                + self._payload().to_bytes(self.PAYLOAD_SIZE, byteorder="little"))
+
     @classmethod
-    def parse_bytes(cls, buffer: bytes):
+    def parse_bytes(cls, buffer: bytes, binary: bool = False):
+        if binary:
+            return cls._parse_binary_bytes(buffer)
         if buffer[0] != CMD_START_INT or buffer[-1] != CMD_END_INT:
             logging.error("Unable to parse buffer!")
             return None
@@ -75,6 +122,25 @@ class Command:
             return None
         return cls._parse_bytes(buffer)
 
+    @classmethod
+    def _parse_binary_bytes(cls, buffer: bytes):
+        if len(buffer) < BIN_HEADER_SIZE or buffer[0] != BIN_SOF:
+            logging.error("Unable to parse binary buffer!")
+            return None
+        try:
+            opcode = Opcode(buffer[2])
+        except ValueError:
+            logging.error(f"Command type for opcode {buffer[2]} is not found!")
+            return None
+        cmd_cls = BINARY_COMMANDS[opcode]
+        if cls.OPCODE != None and cmd_cls != cls:
+            logging.error("Wrong opcode!")
+            return None
+        if buffer[1] != cmd_cls.PAYLOAD_SIZE or len(buffer) != BIN_HEADER_SIZE + buffer[1]:
+            logging.error(f"Wrong payload size for opcode {opcode.name}!")
+            return None
+        return cmd_cls._from_payload(int.from_bytes(buffer[BIN_HEADER_SIZE:], byteorder="little"))
+
     @classmethod
     def _parse_bytes(cls, buffer: bytes):
         """
@@ -88,7 +154,7 @@ class Command:
             return DistanceCommand._parse_bytes(buffer)
         elif cmd_id == CommandID.ALTITUDE_MSG_ID:
             return AltitudeCommand._parse_bytes(buffer)
-        elif cmd_id == CommandID.GO_MSG_ID:
+        elif cmd_id == CommandID.GO_MSG_ID or cmd_id == CommandID.GO_BINARY_MSG_ID:
             return GoCommand._parse_bytes(buffer)
         elif cmd_id == CommandID.LED_MSG_ID:
             return LedCommand._parse_bytes(buffer)
@@ -98,6 +164,10 @@ class Command:
             return PressCommand._parse_bytes(buffer)
         elif cmd_id == CommandID.END_MSG_ID:
             return EndCommand._parse_bytes(buffer)
+        elif cmd_id == CommandID.STATS_MSG_ID:
+            return StatsCommand._parse_bytes(buffer)
+        elif cmd_id == CommandID.IDLE_MSG_ID:
+            return IdleCommand._parse_bytes(buffer)
         else:
             # TODO Implement the rest of them
             logging.error(
@@ -116,6 +186,8 @@ class Command:
 # ---------------- Plane CMDs
 class SpeedCommand(Command):
     MSG_ID = CommandID.SPEED_MSG_ID
+    OPCODE = Opcode.SPD
+    PAYLOAD_SIZE = 2
 
     speed: int
 
@@ -127,12 +199,21 @@ class SpeedCommand(Command):
         speed = hexstring2int(buffer[4:8])
         return SpeedCommand(speed)
 
-    def make_bytes(self):
+    @classmethod
+    def _from_payload(cls, value: int):
+        return SpeedCommand(value)
+
+    def _payload(self):
+        return self.speed
+
+    def _make_bytes(self):
         return CMD_START_BYTE + SpeedCommand.MSG_ID + int2hexstring(self.speed) + CMD_END_BYTE
 
 
 class PressCommand(Command):
     MSG_ID = CommandID.PRESS_MSG_ID
+    OPCODE = Opcode.PRS
+    PAYLOAD_SIZE = 1
 
     button: int
 
@@ -147,21 +228,37 @@ class PressCommand(Command):
         button = hexstring2int(buffer[4:6])
         return PressCommand(button)
 
-    def make_bytes(self):
+    @classmethod
+    def _from_payload(cls, value: int):
+        return PressCommand(value)
+
+    def _payload(self):
+        return self.button
+
+    def _make_bytes(self):
         return CMD_START_BYTE + PressCommand.MSG_ID + int2hexstring(self.button, 2) + CMD_END_BYTE
 
 
 class DistanceCommand(Command):
     MSG_ID = CommandID.DISTANCE_MSG_ID
+    OPCODE = Opcode.DST
+    PAYLOAD_SIZE = 2
 
     distance: int
 
     def __init__(self, distance: int):
         self.distance = distance
 
-    def make_bytes(self):
+    def _make_bytes(self):
         return CMD_START_BYTE + CommandID.DISTANCE_MSG_ID + int2hexstring(self.distance) + CMD_END_BYTE
 
+    def _payload(self):
+        return self.distance
+
+    @classmethod
+    def _from_payload(cls, value: int):
+        return DistanceCommand(value)
+
     @classmethod
     def _parse_bytes(cls, buffer: bytes):
         distance = hexstring2int(buffer[4:8])
@@ -171,15 +268,24 @@ class DistanceCommand(Command):
 # ---------------- Simulator CMDs
 class LedCommand(Command):
     MSG_ID = CommandID.LED_MSG_ID
+    OPCODE = Opcode.LED
+    PAYLOAD_SIZE = 1
 
     led: int
 
     def __init__(self, led: int | LedValue):
         self.led = int(led)
 
-    def make_bytes(self):
+    def _make_bytes(self):
         return CMD_START_BYTE + CommandID.LED_MSG_ID + int2hexstring(self.led, 2) + CMD_END_BYTE
 
+    def _payload(self):
+        return self.led
+
+    @classmethod
+    def _from_payload(cls, value: int):
+        return LedCommand(value)
+
     @classmethod
     def _parse_bytes(cls, buffer: bytes):
         button = hexstring2int(buffer[4:6])
@@ -188,6 +294,8 @@ class LedCommand(Command):
 
 class ManualCommand(Command):
     MSG_ID = CommandID.MANUAL_MSG_ID
+    OPCODE = Opcode.MAN
+    PAYLOAD_SIZE = 1
 
     value: int
 
@@ -200,43 +308,72 @@ class ManualCommand(Command):
         value = hexstring2int(buffer[4:6])
         return ManualCommand(value)
 
-    def make_bytes(self):
+    @classmethod
+    def _from_payload(cls, value: int):
+        return ManualCommand(value)
+
+    def _payload(self):
+        return self.value
+
+    def _make_bytes(self):
         return CMD_START_BYTE + ManualCommand.MSG_ID + int2hexstring(self.value, 2) + CMD_END_BYTE
 
 
 class GoCommand(Command):
     MSG_ID = CommandID.GO_MSG_ID
+    OPCODE = Opcode.GOO
+    PAYLOAD_SIZE = 2
 
     total_distance: int
+    binary: bool
+    """
+    Sent as $GOB....#, asking the plane to switch to binary framing
+    """
 
-    def __init__(self, total_distance: int):
+    def __init__(self, total_distance: int, binary: bool = False):
         self.total_distance = total_distance
+        self.binary = binary
 
-    def make_bytes(self):
-        return CMD_START_BYTE + GoCommand.MSG_ID + int2hexstring(self.total_distance) + CMD_END_BYTE
+    def _make_bytes(self):
+        msg_id = CommandID.GO_BINARY_MSG_ID if self.binary else GoCommand.MSG_ID
+        return CMD_START_BYTE + msg_id + int2hexstring(self.total_distance) + CMD_END_BYTE
+
+    def _payload(self):
+        return self.total_distance
 
     @classmethod
     def _parse_bytes(cls, buffer: bytes):
         total_distance = hexstring2int(buffer[4:8])
-        return GoCommand(total_distance)
+        return GoCommand(total_distance, buffer[1:4] == CommandID.GO_BINARY_MSG_ID)
+
+    @classmethod
+    def _from_payload(cls, value: int):
+        return GoCommand(value)
 
 
 class EndCommand(Command):
     MSG_ID = CommandID.END_MSG_ID
+    OPCODE = Opcode.END
 
-    def make_bytes(self):
+    def _make_bytes(self):
         return CMD_START_BYTE + EndCommand.MSG_ID + CMD_END_BYTE
     
     @classmethod
     def _parse_bytes(cls, buffer: bytes):
         return EndCommand()
 
+    @classmethod
+    def _from_payload(cls, value: int):
+        return EndCommand()
+
 
 # ---------------- Both simulator and plane CMDS
 
 
 class AltitudeCommand(Command):
     MSG_ID = CommandID.ALTITUDE_MSG_ID
+    OPCODE = Opcode.ALT
+    PAYLOAD_SIZE = 2
 
     altitude: int
 
@@ -248,10 +385,113 @@ class AltitudeCommand(Command):
         altitude = hexstring2int(buffer[4:8])
         return AltitudeCommand(altitude)
 
-    def make_bytes(self):
+    @classmethod
+    def _from_payload(cls, value: int):
+        return AltitudeCommand(value)
+
+    def _payload(self):
+        return self.altitude
+
+    def _make_bytes(self):
         return CMD_START_BYTE + AltitudeCommand.MSG_ID + int2hexstring(self.altitude) + CMD_END_BYTE
 
 
+class StatsCommand(Command):
+    """
+    Cycle counters of one firmware probe since its previous report:
+    $STAppmmmmMMMMccccccccTTTTTTTT# (probe, min, max, count, total).
+    One Timer1 count is one instruction cycle.
+    """
+    MSG_ID = CommandID.STATS_MSG_ID
+    OPCODE = Opcode.STA
+    PAYLOAD_SIZE = 13
+
+    PROBE_NAMES = ["isr", "timer", "packet_task", "write_to_output"]
+
+    probe: int
+    min: int
+    max: int
+    count: int
+    total: int
+
+    def __init__(self, probe: int, min: int, max: int, count: int, total: int):
+        self.probe = probe
+        self.min = min
+        self.max = max
+        self.count = count
+        self.total = total
+
+    def probe_name(self) -> str:
+        if self.probe < len(self.PROBE_NAMES):
+            return self.PROBE_NAMES[self.probe]
+        return f"probe{self.probe}"
+
+    def mean(self) -> float:
+        return self.total / self.count if self.count else 0.0
+
+    @classmethod
+    def _parse_bytes(cls, buffer: bytes):
+        return StatsCommand(hexstring2int(buffer[4:6]), hexstring2int(buffer[6:10]),
+                            hexstring2int(buffer[10:14]), hexstring2int(buffer[14:22]),
+                            hexstring2int(buffer[22:30]))
+
+    def _make_bytes(self):
+        return (CMD_START_BYTE + StatsCommand.MSG_ID + int2hexstring(self.probe, 2)
+                + int2hexstring(self.min) + int2hexstring(self.max)
+                + int2hexstring(self.count, 8) + int2hexstring(self.total, 8) + CMD_END_BYTE)
+
+    @classmethod
+    def _from_payload(cls, value: int):
+        return StatsCommand(value & 0xff, (value >> 8) & 0xffff, (value >> 24) & 0xffff,
+                            (value >> 40) & 0xffffffff, (value >> 72) & 0xffffffff)
+
+    def _payload(self):
+        return (self.probe | self.min << 8 | self.max << 24
+                | self.count << 40 | self.total << 72)
+
+
+class IdleCommand(Command):
+    """
+    Percentage of the last report window the firmware spent asleep
+    """
+    MSG_ID = CommandID.IDLE_MSG_ID
+    OPCODE = Opcode.IDL
+    PAYLOAD_SIZE = 1
+
+    idle: int
+
+    def __init__(self, idle: int):
+        self.idle = idle
+
+    @classmethod
+    def _parse_bytes(cls, buffer: bytes):
+        return IdleCommand(hexstring2int(buffer[4:6]))
+
+    def _make_bytes(self):
+        return CMD_START_BYTE + IdleCommand.MSG_ID + int2hexstring(self.idle, 2) + CMD_END_BYTE
+
+    @classmethod
+    def _from_payload(cls, value: int):
+        return IdleCommand(value)
+
+    def _payload(self):
+        return self.idle
+
+
+BINARY_COMMANDS = {
+    Opcode.GOO: GoCommand,
+    Opcode.END: EndCommand,
+    Opcode.SPD: SpeedCommand,
+    Opcode.ALT: AltitudeCommand,
+    Opcode.MAN: ManualCommand,
+    Opcode.LED: LedCommand,
+    Opcode.DST: DistanceCommand,
+    Opcode.PRS: PressCommand,
+    Opcode.STA: StatsCommand,
+    Opcode.IDL: IdleCommand,
+}
+
+
 # ---------------- Buffering CMD bytes
 
 
@@ -259,9 +499,16 @@ class CMDBuffer:
     """
     Buffer for building a command. It can only store one command at a time.
     The command string must be parsed directly after it is completed.
+    In binary mode frames are delimited by their length byte instead of
+    CMD_START_BYTE/CMD_END_BYTE.
     """
 
-    def __init__(self):
+    def __init__(self, binary: bool = False):
+        self.binary = binary
+        self.reset()
+
+    def set_binary(self, binary: bool):
+        self.binary = binary
         self.reset()
 
     def append(self, byte):
@@ -273,6 +520,8 @@ class CMDBuffer:
         if self._is_command_string_built:
             logging.error(
                 f"Byte received but the previously built command is not used! Undefined behaviour may occur")
+        if self.binary:
+            return self._append_binary(byte)
         # Check if command string has started
         if len(self._buffer) == 0:
             if byte == CMD_START_BYTE:
@@ -298,6 +547,16 @@ class CMDBuffer:
             self._buffer += byte
             return True
 
+    def _append_binary(self, byte):
+        if len(self._buffer) == 0 and byte[0] != BIN_SOF:
+            # Ignore, we expected a BIN_SOF here
+            return False
+        self._buffer += byte
+        if (len(self._buffer) >= BIN_HEADER_SIZE
+                and len(self._buffer) == BIN_HEADER_SIZE + self._buffer[1]):
+            self._is_command_string_built = True
+        return True
+
     def is_command_string_built(self):
         return self._is_command_string_built
 
@@ -305,7 +564,7 @@ class CMDBuffer:
         if not self._is_command_string_built:
             return None
         # Parse and return a command
-        cmd = Command.parse_bytes(self._buffer)
+        cmd = Command.parse_bytes(self._buffer, self.binary)
         logging.debug(f"CMDBuffer parsed {cmd}")
         self.reset()
         return cmd
@@ -0,0 +1,113 @@
+/*
+ * File:   hexcodec.h
+ *
+ * Table-driven encoder/decoder for the 2- and 4-digit lowercase hex fields
+ * of the serial protocol. Each digit is one table lookup, so the serial
+ * paths do not pull in the printf/scanf engines.
+ *
+ * Building with HEX_USE_STDIO selects the old sprintf/sscanf implementation
+ * behind the same interface, to compare cost and size against it.
+ */
+
+#ifndef HEXCODEC_H
+#define HEXCODEC_H
+
+#include <stdint.h>
+#ifdef HEX_USE_STDIO
+#include <stdio.h>
+#endif
+
+#define HEX_INVALID 0xFF
+
+static const uint8_t hex_digits[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+};
+
+/* Nibble value of the characters '0'..'f', HEX_INVALID for anything else */
+static const uint8_t hex_values['f' - '0' + 1] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9,                                  // '0'..'9'
+    HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID,            // ':'..'='
+    HEX_INVALID, HEX_INVALID, HEX_INVALID,                         // '>'..'@'
+    10, 11, 12, 13, 14, 15,                                        // 'A'..'F'
+    HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, // 'G'..'K'
+    HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, // 'L'..'P'
+    HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, // 'Q'..'U'
+    HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, // 'V'..'Z'
+    HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, // '['..'_'
+    HEX_INVALID,                                                   // '`'
+    10, 11, 12, 13, 14, 15                                         // 'a'..'f'
+};
+
+/* Returns the value of one hex digit, or HEX_INVALID */
+static inline uint8_t hex_nibble(uint8_t c) {
+    c -= '0';
+    return (c < sizeof(hex_values)) ? hex_values[c] : HEX_INVALID;
+}
+
+/* Writes v as two hex digits to out[0..1] */
+static inline void hex_encode2(uint8_t v, uint8_t* out) {
+#ifdef HEX_USE_STDIO
+    char tmp[3];
+    sprintf(tmp, "%02x", v);
+    out[0] = tmp[0];
+    out[1] = tmp[1];
+#else
+    out[0] = hex_digits[v >> 4];
+    out[1] = hex_digits[v & 0x0F];
+#endif
+}
+
+/* Writes v as four hex digits to out[0..3] */
+static inline void hex_encode4(uint16_t v, uint8_t* out) {
+#ifdef HEX_USE_STDIO
+    char tmp[5];
+    sprintf(tmp, "%04x", v);
+    for (uint8_t i = 0; i < 4; ++i) {
+        out[i] = tmp[i];
+    }
+#else
+    hex_encode2((uint8_t) (v >> 8), out);
+    hex_encode2((uint8_t) v, out + 2);
+#endif
+}
+
+/* Decodes two hex digits from in[0..1]. Returns 0 if one is not a hex digit */
+static inline uint8_t hex_decode2(const uint8_t* in, uint8_t* v) {
+#ifdef HEX_USE_STDIO
+    unsigned int tmp;
+    if (sscanf((const char*) in, "%02x", &tmp) != 1) {
+        return 0;
+    }
+    *v = (uint8_t) tmp;
+    return 1;
+#else
+    uint8_t hi = hex_nibble(in[0]);
+    uint8_t lo = hex_nibble(in[1]);
+    if ((hi | lo) & 0xF0) {
+        return 0;
+    }
+    *v = (uint8_t) ((hi << 4) | lo);
+    return 1;
+#endif
+}
+
+/* Decodes four hex digits from in[0..3]. Returns 0 if one is not a hex digit */
+static inline uint8_t hex_decode4(const uint8_t* in, uint16_t* v) {
+#ifdef HEX_USE_STDIO
+    unsigned int tmp;
+    if (sscanf((const char*) in, "%04x", &tmp) != 1) {
+        return 0;
+    }
+    *v = (uint16_t) tmp;
+    return 1;
+#else
+    uint8_t hi, lo;
+    if (!hex_decode2(in, &hi) || !hex_decode2(in + 2, &lo)) {
+        return 0;
+    }
+    *v = (uint16_t) ((hi << 8) | lo);
+    return 1;
+#endif
+}
+
+#endif /* HEXCODEC_H */
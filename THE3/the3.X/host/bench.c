@@ -0,0 +1,504 @@
+/*
+ * File:   bench.c
+ *
+ * Host benchmark for the THE3 autopilot firmware. A recorded serial trace
+ * is replayed through the mock USART, one 100 ms Timer0 period per trace
+ * line, and every interrupt handler and main-loop task is timed on the
+ * host. The numbers are host nanoseconds, not PIC cycles, so they are only
+ * meaningful relative to another run of the same bench on the same machine.
+ * The one exception is "spin Tcy": the worst number of virtual instruction
+ * cycles a single call spent busy-waiting on the USART, taken from the
+ * transmitter model in mock_sfr.c. That is the time the handler blocks
+ * every other interrupt on the real part.
+ *
+ * Usage: bench [-n iterations] [-p passes] [-d] trace
+ *        bench -c [-n iterations] [-p passes]
+ *   -n  replay the trace this many times (default 200)
+ *   -p  main-loop passes given to the firmware per received byte (default 2)
+ *   -d  write the bytes transmitted during the first replay to stdout
+ *   -c  time the decode and dispatch of each command type instead, receiving
+ *       every frame 1000 times per iteration
+ */
+
+#include "firmware.h"
+#include "mock_sfr.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+/* **** Trace **** */
+typedef enum {EV_PERIOD, EV_ADC, EV_ADC_NOISE, EV_PORTB} event_type_t;
+
+typedef struct {
+    event_type_t type;
+    uint16_t value;     // analog input, its noise amplitude or PORTB pins
+    uint32_t rx_offset; // EV_PERIOD: first byte in rx_bytes
+    uint32_t rx_len;    // EV_PERIOD: bytes received during the period
+    uint32_t rx_frames; // EV_PERIOD: frames received during the period
+} event_t;
+
+static event_t* events;
+static size_t n_events;
+static uint8_t* rx_bytes;
+static size_t n_rx_bytes;
+
+static void* grow(void* p, size_t* cap, size_t need, size_t elem) {
+    if (need <= *cap) {
+        return p;
+    }
+    *cap = need * 2;
+    p = realloc(p, *cap * elem);
+    if (!p) {
+        perror("realloc");
+        exit(1);
+    }
+    return p;
+}
+
+static void add_event(event_t ev) {
+    static size_t cap;
+    events = grow(events, &cap, n_events + 1, sizeof(event_t));
+    events[n_events++] = ev;
+}
+
+static void add_rx_byte(uint8_t v) {
+    static size_t cap;
+    rx_bytes = grow(rx_bytes, &cap, n_rx_bytes + 1, 1);
+    rx_bytes[n_rx_bytes++] = v;
+}
+
+static void load_trace(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+
+    char line[1024];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char* tok = strtok(line, " \t\r\n");
+        if (!tok || tok[0] == ';') {
+            continue;
+        }
+
+        if (tok[0] == '@') {
+            char* arg = strtok(NULL, " \t\r\n");
+            if (!arg) {
+                fprintf(stderr, "%s:%d: missing argument\n", path, lineno);
+                exit(1);
+            }
+            event_t ev = {0};
+            ev.value = (uint16_t) strtoul(arg, NULL, 0);
+            if (strcmp(tok, "@adc") == 0) {
+                ev.type = EV_ADC;
+            } else if (strcmp(tok, "@adcnoise") == 0) {
+                ev.type = EV_ADC_NOISE;
+            } else if (strcmp(tok, "@portb") == 0) {
+                ev.type = EV_PORTB;
+            } else {
+                fprintf(stderr, "%s:%d: unknown directive %s\n", path, lineno, tok);
+                exit(1);
+            }
+            add_event(ev);
+            continue;
+        }
+
+        // A period: frames separated by blanks, "." for none, "*N" to repeat
+        size_t start = n_rx_bytes;
+        uint32_t frames = 0;
+        unsigned repeat = 1;
+        for (; tok; tok = strtok(NULL, " \t\r\n")) {
+            if (tok[0] == '*') {
+                repeat = (unsigned) strtoul(tok + 1, NULL, 10);
+            } else if (strcmp(tok, ".") != 0) {
+                frames++;
+                // "\xNN" stands for one raw byte, for binary frames
+                for (char* c = tok; *c; ++c) {
+                    if (c[0] == '\\' && c[1] == 'x' && c[2] && c[3]) {
+                        char hex[3] = {c[2], c[3], 0};
+                        add_rx_byte((uint8_t) strtoul(hex, NULL, 16));
+                        c += 3;
+                    } else {
+                        add_rx_byte((uint8_t) *c);
+                    }
+                }
+            }
+        }
+        for (unsigned i = 0; i < repeat; ++i) {
+            event_t ev = {EV_PERIOD, 0, (uint32_t) start, (uint32_t) (n_rx_bytes - start), frames};
+            add_event(ev);
+        }
+    }
+    fclose(f);
+}
+
+/* **** Timing **** */
+static inline uint64_t now_ticks(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+static double ns_per_tick = 1.0;
+
+static void calibrate(void) {
+#ifdef HAVE_TSC
+    struct timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    uint64_t t0 = now_ticks();
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &b);
+    } while ((b.tv_sec - a.tv_sec) * 1000000000L + (b.tv_nsec - a.tv_nsec) < 50000000L);
+    uint64_t t1 = now_ticks();
+    double ns = (double) (b.tv_sec - a.tv_sec) * 1e9 + (double) (b.tv_nsec - a.tv_nsec);
+    ns_per_tick = ns / (double) (t1 - t0);
+#endif
+}
+
+typedef enum {
+    ST_RX_ISR,
+    ST_TX_ISR,
+    ST_TIMER_ISR,
+    ST_ADC_ISR,
+    ST_PORTB_ISR,
+    ST_SCHED_RUN,
+    ST_COUNT
+} stat_id_t;
+
+static const char* stat_names[ST_COUNT] = {
+    "rx isr", "tx isr", "timer isr", "adc isr", "portb isr", "sched_run",
+};
+
+typedef struct {
+    uint64_t calls;
+    uint64_t total;
+    uint64_t max;
+    uint64_t spin_max; // virtual cycles spent polling TXSTA1 in one call
+} stat_t;
+
+static stat_t stats[ST_COUNT];
+
+static inline void account(stat_id_t id, uint64_t t0, uint64_t t1) {
+    uint64_t d = t1 - t0;
+    stats[id].calls++;
+    stats[id].total += d;
+    if (d > stats[id].max) {
+        stats[id].max = d;
+    }
+}
+
+/* **** Replay **** */
+static int dumping;
+static uint64_t tx_count;
+static uint64_t frames_out;
+
+/*
+ * Output frames are counted on their last byte: '#' for ASCII frames, the
+ * end of the payload given by the length byte for binary ones.
+ */
+typedef enum {TX_IDLE, TX_ASCII, TX_BIN_LEN, TX_BIN_BODY} tx_frame_state_t;
+static tx_frame_state_t tx_frame_state;
+static unsigned tx_frame_left;
+
+static void count_tx_frame(uint8_t v) {
+    switch (tx_frame_state) {
+    case TX_IDLE:
+        if (v == '$') {
+            tx_frame_state = TX_ASCII;
+        } else if (v == 0xA5) {
+            tx_frame_state = TX_BIN_LEN;
+        }
+        break;
+    case TX_ASCII:
+        if (v == '#') {
+            frames_out++;
+            tx_frame_state = TX_IDLE;
+        }
+        break;
+    case TX_BIN_LEN:
+        tx_frame_left = v + 1u; // opcode + payload
+        tx_frame_state = TX_BIN_BODY;
+        break;
+    case TX_BIN_BODY:
+        if (--tx_frame_left == 0) {
+            frames_out++;
+            tx_frame_state = TX_IDLE;
+        }
+        break;
+    }
+}
+
+static void collect_tx(void) {
+    uint8_t v;
+    if (mock_uart_transmitted(&v)) {
+        tx_count++;
+        count_tx_frame(v);
+        if (dumping) {
+            putchar(v);
+        }
+    }
+}
+
+static void isr(stat_id_t id) {
+    uint64_t c0 = mock_cycles;
+    uint64_t t0 = now_ticks();
+    highPriorityISR();
+    account(id, t0, now_ticks());
+    if (mock_cycles - c0 > stats[id].spin_max) {
+        stats[id].spin_max = mock_cycles - c0;
+    }
+    collect_tx();
+}
+
+/* Lets the USART drain: one TX1IF per byte until the firmware stops sending */
+static void service_tx(void) {
+    while (mock_TXSTA1.TXEN && PIE1bits.TX1IE && INTCONbits.GIE) {
+        mock_uart_wait_tx_ready();
+        uint64_t before = tx_count;
+        isr(ST_TX_ISR);
+        if (tx_count == before && mock_TXSTA1.TXEN && PIE1bits.TX1IE) {
+            break;
+        }
+    }
+}
+
+/* Main-loop passes, and those that found no task posted and would sleep */
+static uint64_t main_passes;
+static uint64_t idle_passes;
+
+static void main_pass(void) {
+    main_passes++;
+    if (!sched_ready) {
+        idle_passes++;
+    }
+    uint64_t t0 = now_ticks();
+    sched_run();
+    account(ST_SCHED_RUN, t0, now_ticks());
+    collect_tx();
+    service_tx();
+}
+
+/* Instruction cycles in one 100 ms Timer0 period at 10 MIPS */
+#define PERIOD_CYCLES 1000000u
+
+static uint16_t adc_input;
+static uint16_t adc_noise;
+static uint32_t adc_seed;
+
+/* One conversion result: adc_input plus uniform noise of +-adc_noise */
+static uint16_t adc_sample(void) {
+    int v = adc_input;
+    if (adc_noise) {
+        adc_seed = adc_seed * 1103515245u + 12345u;
+        v += (int) ((adc_seed >> 16) % (2u * adc_noise + 1u)) - adc_noise;
+    }
+    return (uint16_t) (v < 0 ? 0 : v > 1023 ? 1023 : v);
+}
+
+static void replay(unsigned passes) {
+    for (size_t e = 0; e < n_events; ++e) {
+        const event_t* ev = &events[e];
+        switch (ev->type) {
+        case EV_ADC:
+            adc_input = ev->value;
+            break;
+        case EV_ADC_NOISE:
+            adc_noise = ev->value;
+            break;
+        case EV_PORTB:
+            PORTB = (uint8_t) ev->value;
+            if (INTCONbits.RBIE && INTCONbits.GIE) {
+                INTCONbits.RBIF = 1;
+                isr(ST_PORTB_ISR);
+            }
+            break;
+        case EV_PERIOD:
+            for (uint32_t i = 0; i < ev->rx_len; ++i) {
+                if (PIE1bits.RC1IE && INTCONbits.GIE) {
+                    mock_uart_receive(rx_bytes[ev->rx_offset + i]);
+                    isr(ST_RX_ISR);
+                }
+                for (unsigned p = 0; p < passes; ++p) {
+                    main_pass();
+                }
+            }
+            // Conversions started by the CCP2 special event trigger
+            for (unsigned n = mock_ccp2_special_events(PERIOD_CYCLES); n > 0; --n) {
+                mock_adc_complete(adc_sample());
+                if (PIE1bits.ADIE && INTCONbits.GIE) {
+                    isr(ST_ADC_ISR);
+                }
+            }
+            if (INTCONbits.TMR0IE && INTCONbits.GIE) {
+                INTCONbits.TMR0IF = 1;
+                isr(ST_TIMER_ISR);
+            }
+            // A conversion started in software by setting GODONE
+            if (GODONE && ADCON0bits.ADON && INTCONbits.GIE) {
+                mock_adc_complete(adc_sample());
+                isr(ST_ADC_ISR);
+            }
+            service_tx();
+            for (unsigned p = 0; p < passes; ++p) {
+                main_pass();
+            }
+            break;
+        }
+    }
+}
+
+static void boot(void) {
+    adc_input = 0;
+    adc_noise = 0;
+    adc_seed = 1;
+    mock_reset();
+    init_ports();
+    init_serial();
+    init_interrupts();
+    init_timer();
+    init_adcon();
+    start_system();
+}
+
+/* **** Command microbenchmark **** */
+/*
+ * Receives the same frame over and over and times the receive interrupt
+ * and the packet_task passes of all its bytes, i.e. everything it takes to
+ * decode and run the command. The last frame has an unknown ID and times
+ * rejecting it.
+ */
+static const char* const command_frames[] = {
+    "$GOO1f40#", "$END#", "$SPD000a#", "$ALT0000#", "$MAN00#", "$LED00#", "$XYZ00#",
+};
+
+static void command_bench(unsigned reps, unsigned passes) {
+    printf("%-12s %10s %12s\n", "frame", "ns/frame", "ticks/frame");
+    for (size_t f = 0; f < sizeof(command_frames) / sizeof(command_frames[0]); ++f) {
+        const char* frame = command_frames[f];
+        uint64_t total = 0;
+        boot();
+        for (unsigned r = 0; r < reps; ++r) {
+            uint64_t t0 = now_ticks();
+            for (const char* c = frame; *c; ++c) {
+                mock_uart_receive((uint8_t) *c);
+                highPriorityISR();
+                for (unsigned p = 0; p < passes; ++p) {
+                    packet_task();
+                }
+            }
+            total += now_ticks() - t0;
+            // END turns interrupts off, the next frame needs them back on
+            start_system();
+        }
+        printf("%-12s %10.1f %12.1f\n", frame, (double) total * ns_per_tick / reps, (double) total / reps);
+    }
+}
+
+int main(int argc, char** argv) {
+    unsigned iterations = 200;
+    unsigned passes = 2;
+    int dump = 0;
+    int commands = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:dc")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = (unsigned) strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            passes = (unsigned) strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            dump = 1;
+            break;
+        case 'c':
+            commands = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-p passes] [-d] trace\n", argv[0]);
+            return 2;
+        }
+    }
+    if (commands && iterations > 0) {
+        calibrate();
+        command_bench(iterations * 1000, passes);
+        return 0;
+    }
+    if (optind != argc - 1 || iterations == 0) {
+        fprintf(stderr, "usage: %s [-n iterations] [-p passes] [-d] trace\n", argv[0]);
+        return 2;
+    }
+
+    load_trace(argv[optind]);
+    uint64_t frames_in = 0;
+    uint64_t bytes_in = 0;
+    for (size_t e = 0; e < n_events; ++e) {
+        if (events[e].type == EV_PERIOD) {
+            bytes_in += events[e].rx_len;
+            frames_in += events[e].rx_frames;
+        }
+    }
+
+    if (dump) {
+        // Only the first replay after a clean boot is reproducible
+        boot();
+        dumping = 1;
+        replay(passes);
+        putchar('\n');
+        return 0;
+    }
+
+    calibrate();
+    struct timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    for (unsigned it = 0; it < iterations; ++it) {
+        boot();
+        replay(passes);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    double wall = (double) (b.tv_sec - a.tv_sec) + (double) (b.tv_nsec - a.tv_nsec) * 1e-9;
+
+    printf("trace %s: %llu frames in, %llu frames out, %u iterations, %u passes/byte\n", argv[optind],
+           (unsigned long long) frames_in, (unsigned long long) frames_out / iterations, iterations, passes);
+    printf("%-14s %12s %12s %10s %10s %10s\n", "handler", "calls", "total ms", "mean ns", "max ns", "spin Tcy");
+    for (int i = 0; i < ST_COUNT; ++i) {
+        const stat_t* s = &stats[i];
+        if (s->calls == 0) {
+            continue;
+        }
+        printf("%-14s %12llu %12.3f %10.1f %10.1f %10llu\n", stat_names[i], (unsigned long long) s->calls,
+               (double) s->total * ns_per_tick * 1e-6, (double) s->total * ns_per_tick / (double) s->calls,
+               (double) s->max * ns_per_tick, (unsigned long long) s->spin_max);
+    }
+
+    printf("%-14s %12s %12s %10s\n", "ring", "high water", "overflow", "underflow");
+    printf("%-14s %12u %12u %10u\n", "inbuf", inbuf.high_water, inbuf.overflow, inbuf.underflow);
+    printf("%-14s %12u %12u %10u\n", "outbuf", outbuf.high_water, outbuf.overflow, outbuf.underflow);
+    printf("tx frames dropped: %u\n", tx_frames_dropped);
+    printf("main passes with no task posted: %.1f%%\n",
+           main_passes ? 100.0 * (double) idle_passes / (double) main_passes : 0.0);
+
+    double rx_path = (double) (stats[ST_RX_ISR].total + stats[ST_SCHED_RUN].total) * ns_per_tick;
+    double tx_path = (double) (stats[ST_TIMER_ISR].total + stats[ST_TX_ISR].total) * ns_per_tick;
+    uint64_t packets = frames_in * iterations;
+    printf("per-packet cost: rx %.1f ns/frame in, tx %.1f ns/frame out\n", packets ? rx_path / (double) packets : 0.0,
+           frames_out ? tx_path / (double) frames_out : 0.0);
+    printf("throughput: %.0f frames in/s, %.0f bytes in/s (%.3f s wall)\n", (double) packets / wall,
+           (double) (bytes_in * iterations) / wall, wall);
+    return 0;
+}
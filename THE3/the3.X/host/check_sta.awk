@@ -0,0 +1,40 @@
+# Checks the $STA frames of a profiled replay, one frame per line as
+# printed by "make profile": each of the PROBES probes reports calls at
+# least once, and every report with calls has 0 < min <= max and a mean
+# below MAX_MEAN cycles.
+#
+# Usage: awk -v PROBES=n -v MAX_MEAN=cycles -f check_sta.awk
+
+function hex(s,    i, v) {
+    v = 0
+    for (i = 1; i <= length(s); i++) {
+        v = v * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+    }
+    return v
+}
+
+/^\$STA[0-9a-f]+#$/ && length($0) == 31 {
+    probe = hex(substr($0, 5, 2))
+    min = hex(substr($0, 7, 4))
+    max = hex(substr($0, 11, 4))
+    count = hex(substr($0, 15, 8))
+    total = hex(substr($0, 23, 8))
+    frames++
+    if (count == 0) next
+    hit[probe] = 1
+    if (min == 0 || min > max || total / count > MAX_MEAN) {
+        printf "implausible probe %d: min %d max %d count %d total %d\n", probe, min, max, count, total
+        bad = 1
+    }
+}
+
+END {
+    for (p = 0; p < PROBES; p++) {
+        if (!hit[p]) {
+            printf "probe %d never reported calls\n", p
+            bad = 1
+        }
+    }
+    printf "%d $STA frames checked\n", frames
+    exit bad || frames == 0
+}
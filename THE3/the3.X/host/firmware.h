@@ -0,0 +1,30 @@
+/*
+ * File:   firmware.h
+ *
+ * Entry points of main.c that the host bench drives directly. The firmware
+ * itself has no header, so these mirror the definitions in ../main.c.
+ */
+
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+#include "../ring.h"
+
+void init_ports(void);
+void init_serial(void);
+void init_interrupts(void);
+void init_timer(void);
+void init_adcon(void);
+void start_system(void);
+
+void packet_task(void);
+void sched_run(void);
+
+void highPriorityISR(void);
+
+extern ring_t inbuf;
+extern ring_t outbuf;
+extern uint8_t tx_frames_dropped;
+extern volatile uint8_t sched_ready;
+
+#endif /* FIRMWARE_H */
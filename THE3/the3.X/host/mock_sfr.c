@@ -0,0 +1,184 @@
+/*
+ * File:   mock_sfr.c
+ *
+ * Storage and bench hooks for the mock register file, see mock_sfr.h.
+ */
+
+#include "mock_sfr.h"
+
+volatile mock_INTCON_t mock_INTCON;
+volatile mock_INTCON2_t mock_INTCON2;
+volatile mock_PIR1_t mock_PIR1;
+volatile mock_PIE1_t mock_PIE1;
+volatile mock_TXSTA1_t mock_TXSTA1;
+volatile mock_RCSTA1_t mock_RCSTA1;
+volatile mock_BAUDCON1_t mock_BAUDCON1;
+volatile mock_OSCCON_t mock_OSCCON;
+volatile mock_T0CON_t mock_T0CON;
+volatile mock_T1CON_t mock_T1CON;
+volatile mock_T3CON_t mock_T3CON;
+volatile mock_ADCON0_t mock_ADCON0;
+volatile mock_ADCON2_t mock_ADCON2;
+
+volatile uint8_t PORTA, PORTB, PORTC, PORTD;
+volatile uint8_t TRISA, TRISB, TRISC, TRISD, TRISH;
+volatile uint8_t TMR0H, TMR0L;
+volatile uint8_t TMR1H;
+volatile uint8_t ADRESH, ADRESL, ADCON1;
+volatile uint8_t TMR3H, TMR3L, CCP2CON, CCPR2H, CCPR2L;
+volatile uint8_t SPBRG1, SPBRGH1;
+
+uint64_t mock_cycles;
+
+static volatile uint8_t txreg1;
+static uint8_t rcreg1;
+static int tx_written;
+static int txreg_full;
+static int tsr_busy;
+static uint64_t tsr_done;
+
+/* Instruction cycles needed to shift out one 8N1 character */
+static uint32_t char_cycles(void) {
+    uint16_t n = mock_BAUDCON1.BRG16 ? (uint16_t) ((SPBRGH1 << 8) | SPBRG1) : SPBRG1;
+    uint32_t fosc_per_bit;
+    if (mock_BAUDCON1.BRG16) {
+        fosc_per_bit = (mock_TXSTA1.BRGH ? 4u : 16u) * (n + 1u);
+    } else {
+        fosc_per_bit = (mock_TXSTA1.BRGH ? 16u : 64u) * (n + 1u);
+    }
+    return 10u * fosc_per_bit / 4u;
+}
+
+/* Brings the transmitter up to mock_cycles */
+static void uart_update(void) {
+    if (tsr_busy && mock_cycles >= tsr_done) {
+        tsr_busy = 0;
+    }
+    if (txreg_full && !tsr_busy && mock_TXSTA1.TXEN) {
+        txreg_full = 0;
+        tsr_busy = 1;
+        tsr_done = mock_cycles + char_cycles();
+    }
+    mock_TXSTA1.TRMT = !tsr_busy;
+    mock_PIR1.TX1IF = mock_TXSTA1.TXEN && !txreg_full;
+}
+
+volatile mock_TXSTA1_t* mock_txsta1(void) {
+    mock_cycles += MOCK_POLL_CYCLES;
+    uart_update();
+    return &mock_TXSTA1;
+}
+
+volatile uint8_t* mock_txreg1(void) {
+    // The firmware only ever writes TXREG1, so any access is a transmission
+    tx_written = 1;
+    txreg_full = 1;
+    mock_PIR1.TX1IF = 0;
+    return &txreg1;
+}
+
+void mock_uart_wait_tx_ready(void) {
+    uart_update();
+    if (txreg_full && tsr_busy && mock_TXSTA1.TXEN) {
+        mock_cycles = tsr_done;
+        uart_update();
+    }
+}
+
+uint8_t mock_rcreg1(void) {
+    mock_PIR1.RC1IF = 0;
+    return rcreg1;
+}
+
+uint64_t mock_run_cycles;
+
+/* Called by -finstrument-functions on every firmware function entry and exit */
+void __cyg_profile_func_enter(void* fn, void* site) {
+    mock_run_cycles += MOCK_CALL_CYCLES;
+}
+
+void __cyg_profile_func_exit(void* fn, void* site) {
+}
+
+uint8_t mock_tmr1l(void) {
+    uint16_t tmr1 = mock_T1CON.TMR1ON ? (uint16_t) (mock_cycles + mock_run_cycles) : 0;
+    TMR1H = (uint8_t) (tmr1 >> 8);
+    return (uint8_t) tmr1;
+}
+
+/* Instruction cycles Timer3's prescaler has counted towards the next tick */
+static uint32_t tmr3_prescaler;
+
+unsigned mock_ccp2_special_events(uint32_t cycles) {
+    uint16_t period = (uint16_t) ((CCPR2H << 8) | CCPR2L);
+    int on_timer3 = mock_T3CON.T3CCP1 || mock_T3CON.T3CCP2;
+    if (!mock_T3CON.TMR3ON || mock_T3CON.TMR3CS || !on_timer3 || (CCP2CON & 0x0F) != 0x0B || period == 0) {
+        return 0;
+    }
+    uint32_t prescale = 1u << mock_T3CON.T3CKPS;
+    uint32_t ticks = (tmr3_prescaler + cycles) / prescale;
+    tmr3_prescaler = (tmr3_prescaler + cycles) % prescale;
+
+    // Every match with CCPR2 resets Timer3 and starts a conversion
+    uint32_t count = (uint32_t) ((TMR3H << 8) | TMR3L) + ticks;
+    unsigned events = (unsigned) (count / period);
+    count %= period;
+    TMR3H = (uint8_t) (count >> 8);
+    TMR3L = (uint8_t) count;
+    return mock_ADCON0.ADON ? events : 0;
+}
+
+void mock_reset(void) {
+    mock_INTCON.reg = 0x00;
+    mock_INTCON2.reg = 0xFF;
+    mock_PIR1.reg = 0x00;
+    mock_PIE1.reg = 0x00;
+    mock_TXSTA1.reg = 0x02; // TRMT: shift register empty
+    mock_RCSTA1.reg = 0x00;
+    mock_BAUDCON1.reg = 0x40;
+    mock_OSCCON.reg = 0x40; // IRCF = 100, as after a POR
+    mock_T0CON.reg = 0xFF;
+    mock_T1CON.reg = 0x00;
+    mock_T3CON.reg = 0x00;
+    mock_ADCON0.reg = 0x00;
+    mock_ADCON2.reg = 0x00;
+
+    PORTA = PORTB = PORTC = PORTD = 0;
+    TRISA = TRISB = TRISC = TRISD = TRISH = 0xFF;
+    TMR0H = TMR0L = 0;
+    TMR1H = 0;
+    TMR3H = TMR3L = CCP2CON = CCPR2H = CCPR2L = 0;
+    tmr3_prescaler = 0;
+    ADRESH = ADRESL = ADCON1 = 0;
+    SPBRG1 = SPBRGH1 = 0;
+
+    txreg1 = 0;
+    rcreg1 = 0;
+    tx_written = 0;
+    txreg_full = 0;
+    tsr_busy = 0;
+    tsr_done = 0;
+    mock_cycles = 0;
+    mock_run_cycles = 0;
+}
+
+void mock_uart_receive(uint8_t v) {
+    rcreg1 = v;
+    mock_PIR1.RC1IF = 1;
+}
+
+int mock_uart_transmitted(uint8_t* v) {
+    if (!tx_written) {
+        return 0;
+    }
+    tx_written = 0;
+    *v = txreg1;
+    return 1;
+}
+
+void mock_adc_complete(uint16_t result) {
+    ADRESH = (uint8_t) (result >> 8);
+    ADRESL = (uint8_t) result;
+    mock_ADCON0.GO_nDONE = 0;
+    mock_PIR1.ADIF = 1;
+}
@@ -0,0 +1,153 @@
+/*
+ * File:   mock_sfr.h
+ *
+ * Mock PIC18F8722 register file for the host build. Only the registers
+ * touched by the firmware are modelled. Byte registers are plain variables,
+ * bit-addressable ones are unions so that both FOO and FOObits work like on
+ * the real part. TXREG1 and RCREG1 go through small accessors so that the
+ * bench can observe transmitted bytes and reading RCREG1 clears RC1IF, as
+ * the USART does.
+ *
+ * The transmitter is timed against a virtual instruction-cycle clock,
+ * mock_cycles. A byte written to TXREG1 moves to the shift register when
+ * that is idle and keeps TRMT low for one character time at the configured
+ * baud rate. Every access to TXSTA1 costs MOCK_POLL_CYCLES, so a loop
+ * spinning on TRMT burns virtual cycles the bench can measure.
+ */
+
+#ifndef MOCK_SFR_H
+#define MOCK_SFR_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define _XTAL_FREQ 40000000
+
+/* XC8 keywords and intrinsics that have no meaning on the host */
+#define __interrupt(priority)
+#define NOP()
+#define CLRWDT()
+#define SLEEP() /* the bench only calls sched_run, the main loop never sleeps */
+
+/* Declares a bit-addressable register NAME and its NAMEbits view */
+#define MOCK_SFR_BITS(name, fields) \
+    typedef union {                 \
+        uint8_t reg;                \
+        struct {                    \
+            fields                  \
+        };                          \
+    } mock_##name##_t;              \
+    extern volatile mock_##name##_t mock_##name
+
+MOCK_SFR_BITS(INTCON, unsigned RBIF : 1; unsigned INT0IF : 1; unsigned TMR0IF : 1; unsigned RBIE : 1; unsigned INT0IE : 1;
+              unsigned TMR0IE : 1; unsigned PEIE : 1; unsigned GIE : 1;);
+MOCK_SFR_BITS(INTCON2, unsigned RBIP : 1; unsigned INT3IP : 1; unsigned TMR0IP : 1; unsigned INTEDG3 : 1; unsigned INTEDG2 : 1;
+              unsigned INTEDG1 : 1; unsigned INTEDG0 : 1; unsigned NOT_RBPU : 1;);
+MOCK_SFR_BITS(PIR1, unsigned TMR1IF : 1; unsigned TMR2IF : 1; unsigned CCP1IF : 1; unsigned SSP1IF : 1; unsigned TX1IF : 1;
+              unsigned RC1IF : 1; unsigned ADIF : 1; unsigned PSPIF : 1;);
+MOCK_SFR_BITS(PIE1, unsigned TMR1IE : 1; unsigned TMR2IE : 1; unsigned CCP1IE : 1; unsigned SSP1IE : 1; unsigned TX1IE : 1;
+              unsigned RC1IE : 1; unsigned ADIE : 1; unsigned PSPIE : 1;);
+MOCK_SFR_BITS(TXSTA1, unsigned TX9D : 1; unsigned TRMT : 1; unsigned BRGH : 1; unsigned SENDB : 1; unsigned SYNC : 1;
+              unsigned TXEN : 1; unsigned TX9 : 1; unsigned CSRC : 1;);
+MOCK_SFR_BITS(RCSTA1, unsigned RX9D : 1; unsigned OERR : 1; unsigned FERR : 1; unsigned ADDEN : 1; unsigned CREN : 1;
+              unsigned SREN : 1; unsigned RX9 : 1; unsigned SPEN : 1;);
+MOCK_SFR_BITS(BAUDCON1, unsigned ABDEN : 1; unsigned WUE : 1; unsigned : 1; unsigned BRG16 : 1; unsigned SCKP : 1; unsigned : 1;
+              unsigned RCIDL : 1; unsigned ABDOVF : 1;);
+MOCK_SFR_BITS(OSCCON, unsigned SCS : 2; unsigned IOFS : 1; unsigned OSTS : 1; unsigned IRCF : 3; unsigned IDLEN : 1;);
+MOCK_SFR_BITS(T0CON, unsigned T0PS0 : 1; unsigned T0PS1 : 1; unsigned T0PS2 : 1; unsigned PSA : 1; unsigned T0SE : 1;
+              unsigned T0CS : 1; unsigned T08BIT : 1; unsigned TMR0ON : 1;);
+MOCK_SFR_BITS(T1CON, unsigned TMR1ON : 1; unsigned TMR1CS : 1; unsigned nT1SYNC : 1; unsigned T1OSCEN : 1; unsigned T1CKPS : 2;
+              unsigned T1RUN : 1; unsigned RD16 : 1;);
+MOCK_SFR_BITS(T3CON, unsigned TMR3ON : 1; unsigned TMR3CS : 1; unsigned nT3SYNC : 1; unsigned T3CCP1 : 1; unsigned T3CKPS : 2;
+              unsigned T3CCP2 : 1; unsigned RD16 : 1;);
+MOCK_SFR_BITS(ADCON0, unsigned ADON : 1; unsigned GO_nDONE : 1; unsigned CHS : 4; unsigned : 2;);
+MOCK_SFR_BITS(ADCON2, unsigned ADCS : 3; unsigned ACQT : 3; unsigned : 1; unsigned ADFM : 1;);
+
+#define INTCON       mock_INTCON.reg
+#define INTCONbits   mock_INTCON
+#define INTCON2      mock_INTCON2.reg
+#define INTCON2bits  mock_INTCON2
+#define PIR1         mock_PIR1.reg
+#define PIR1bits     mock_PIR1
+#define PIE1         mock_PIE1.reg
+#define PIE1bits     mock_PIE1
+#define TXSTA1       (mock_txsta1()->reg)
+#define TXSTA1bits   (*mock_txsta1())
+#define RCSTA1       mock_RCSTA1.reg
+#define RCSTA1bits   mock_RCSTA1
+#define BAUDCON1     mock_BAUDCON1.reg
+#define BAUDCON1bits mock_BAUDCON1
+#define OSCCON       mock_OSCCON.reg
+#define OSCCONbits   mock_OSCCON
+#define T0CON        mock_T0CON.reg
+#define T0CONbits    mock_T0CON
+#define T1CON        mock_T1CON.reg
+#define T1CONbits    mock_T1CON
+#define T3CON        mock_T3CON.reg
+#define T3CONbits    mock_T3CON
+#define ADCON0       mock_ADCON0.reg
+#define ADCON0bits   mock_ADCON0
+#define ADCON2       mock_ADCON2.reg
+#define ADCON2bits   mock_ADCON2
+#define GODONE       mock_ADCON0.GO_nDONE
+
+extern volatile uint8_t PORTA, PORTB, PORTC, PORTD;
+extern volatile uint8_t TRISA, TRISB, TRISC, TRISD, TRISH;
+extern volatile uint8_t TMR0H, TMR0L;
+extern volatile uint8_t ADRESH, ADRESL, ADCON1;
+extern volatile uint8_t TMR3H, TMR3L, CCP2CON, CCPR2H, CCPR2L;
+extern volatile uint8_t SPBRG1, SPBRGH1;
+
+/* USART registers */
+#define MOCK_POLL_CYCLES 3 /* movf/btfss + bra of a polling loop */
+extern uint64_t mock_cycles;
+volatile mock_TXSTA1_t* mock_txsta1(void);
+volatile uint8_t* mock_txreg1(void);
+uint8_t mock_rcreg1(void);
+#define TXREG1 (*mock_txreg1())
+#define RCREG1 (mock_rcreg1())
+
+/*
+ * Instruction time of the firmware code itself. The host cannot count the
+ * PIC instructions a call would take, so every firmware function call is
+ * charged MOCK_CALL_CYCLES: call, return, argument moves and a short body.
+ * The hooks in mock_sfr.c do the counting when the firmware is built with
+ * -finstrument-functions, as the PROFILE builds in the Makefile are, and
+ * the counts are the same on every run. Without it they stay at 0.
+ */
+#define MOCK_CALL_CYCLES 25
+extern uint64_t mock_run_cycles;
+
+/*
+ * Timer1 counts mock_cycles plus mock_run_cycles while TMR1ON is set,
+ * reading TMR1L latches TMR1H
+ */
+extern volatile uint8_t TMR1H;
+uint8_t mock_tmr1l(void);
+#define TMR1L (mock_tmr1l())
+
+/* **** Bench side of the mock **** */
+
+/* Puts every register back to its power-on value */
+void mock_reset(void);
+
+/* Latches a received byte into RCREG1 and raises RC1IF */
+void mock_uart_receive(uint8_t v);
+
+/* Returns 1 and stores the byte if the firmware wrote TXREG1 since last call */
+int mock_uart_transmitted(uint8_t* v);
+
+/* Advances mock_cycles until TXREG1 can take a byte (TX1IF set) */
+void mock_uart_wait_tx_ready(void);
+
+/* Loads a 10-bit conversion result into ADRESH:ADRESL and raises ADIF */
+void mock_adc_complete(uint16_t result);
+
+/*
+ * Runs Timer3 for the given number of instruction cycles and returns how
+ * many CCP2 special event triggers, i.e. A/D conversion starts, it caused.
+ * Zero unless CCP2 is in special event mode on Timer3 with the ADC on.
+ */
+unsigned mock_ccp2_special_events(uint32_t cycles);
+
+#endif /* MOCK_SFR_H */
@@ -8,50 +8,39 @@
  */
 
 
-#include <xc.h>
 #include <stdint.h>
-#include "pragmas.h"
-
-inline void disable_rxtx( void ) { PIE1bits.RC1IE = 0;PIE1bits.TX1IE = 0;}
-inline void enable_rxtx( void )  { PIE1bits.RC1IE = 1;PIE1bits.TX1IE = 1;}
+#include "hal.h"
+#include "hexcodec.h"
+#include "ring.h"
+#include "profile.h"
 
 /* **** Ring-buffers for incoming and outgoing data **** */
-// These buffer functions are modularized to handle both the input and
-// output buffers with an input argument.
-typedef enum {INBUF = 0, OUTBUF = 1} buf_t;
-
-#define BUFSIZE 128       /* Static buffer size. Maximum amount of data */
-uint8_t inbuf[BUFSIZE];   /* Preallocated buffer for incoming data */
-uint8_t outbuf[BUFSIZE];  /* Preallocated buffer for outgoing data  */
-uint8_t head[2] = {0, 0}; /* head for pushing, tail for popping */
-uint8_t tail[2] = {0, 0};
-
-/* Check if a buffer had data or not */
-#pragma interrupt_level 2 // Prevents duplication of function
-uint8_t buf_isempty( buf_t buf ) { return (head[buf] == tail[buf])?1:0; }
-/* Place new data in buffer */
-#pragma interrupt_level 2 // Prevents duplication of function
-void buf_push( uint8_t v, buf_t buf) {
-    if (buf == INBUF) inbuf[head[buf]] = v;
-    else outbuf[head[buf]] = v;
-    head[buf]++;
-    if (head[buf] == BUFSIZE) head[buf] = 0;
-    if (head[buf] == tail[buf]) { /*error_overflow();*/ }
-}
-/* Retrieve data from buffer */
-#pragma interrupt_level 2 // Prevents duplication of function
-uint8_t buf_pop( buf_t buf ) {
-    uint8_t v;
-    if (buf_isempty(buf)) { 
-        /*error_underflow();*/ return 0;
-    } else {
-        if (buf == INBUF) v = inbuf[tail[buf]];
-        else v = outbuf[tail[buf]];
-        tail[buf]++;
-        if (tail[buf] == BUFSIZE) tail[buf] = 0;
-        return v;
-    }
-}
+// inbuf is filled by receive_isr and drained by packet_task, outbuf is
+// filled by write_to_output from the timer interrupt and drained by
+// transmit_isr. Each ring has one producer and one consumer, so neither
+// side needs to mask interrupts. See ring.h for the overflow/underflow
+// counters and the high-water mark.
+ring_t inbuf;
+ring_t outbuf;
+// Frames write_to_output dropped because outbuf could not hold all of them
+uint8_t tx_frames_dropped = 0;
+
+/* **** Scheduler **** */
+// Interrupt handlers post tasks by setting their bit in sched_ready and the
+// main loop runs whatever is posted, see sched_run and sched_idle. Bits
+// are set and cleared one at a time, which XC8 compiles to a single
+// BSF/BCF, so neither side needs to mask interrupts.
+#define TASK_PACKET 0x01 // Input waiting in inbuf or cmd_queue
+volatile uint8_t sched_ready = 0;
+#define sched_post(task) (sched_ready |= (task))
+
+#ifdef PROFILE
+prof_stat_t prof_stats[PROF_COUNT];
+uint8_t prof_tick = 0;  // Timer periods since the last $STA frame
+uint8_t prof_probe = 0; // Probe reported in the next $STA frame
+uint32_t sched_busy = 0;   // Cycles spent awake since the last $IDL frame
+uint16_t sched_busy_t0 = 0; // Timer1 when the core last woke up
+#endif
 
 void enable_portb();
 void disable_portb();
@@ -65,6 +54,9 @@ typedef enum {
     LED,
     DISTANCE,
     PRESS,
+    STATS, // $STA profiling frame, see profile.h
+    IDLE,  // $IDL idle percentage, sent with PROFILE
+    GOO_BINARY, // GOO that also switches both directions to binary framing
     UNDEFINED
 } command_type_t;
 
@@ -80,36 +72,71 @@ volatile int remaining_distance = -1;
 volatile int speed = 0;
 volatile int should_send = 0;
 volatile int alt_period = 0;
-volatile int adc_val = 9000;
 // starts from 1 and resets every time altitude input is received.
 volatile int timer_counter = 1;
 volatile int manual_on = 0;
 volatile uint8_t last_portb = 0;
 volatile int write_prs = 0;
 volatile int prs_led = 0;
-volatile int set_godone = 0;
+
+/* **** Altitude acquisition **** */
+/*
+ * CCP2 runs in special event trigger mode on Timer3: every
+ * ADC_SAMPLE_TICKS it resets Timer3 and starts a conversion, so no code
+ * has to set GODONE. handle_adc averages 2^ADC_OVERSAMPLE_SHIFT samples
+ * and moves alt_bin to a neighbouring bin only once the average is
+ * ADC_HYSTERESIS counts past the edge between them.
+ */
+#define ADC_SAMPLE_TICKS 6250  // Timer3 at 1:8 and 10 MIPS: a sample every 5 ms
+#define ADC_OVERSAMPLE_SHIFT 4 // 16 samples, a new average every 80 ms
+#define ADC_HYSTERESIS 16
+
+const int alt_values[4] = {9000, 10000, 11000, 12000};
+// Written only by handle_adc and a single byte, so handle_timer can read
+// it at any time
+volatile uint8_t alt_bin = 0;
+uint16_t adc_sum = 0;    // Sum of the samples of the current window
+uint8_t adc_samples = 0; // Samples in adc_sum
 
 void write_to_output(const command_t* cmd);
+#ifdef PROFILE
+void write_stats(uint8_t probe);
+#endif
 
 /* **** ISR functions **** */
+#ifdef RX_PARSE_IN_ISR
+void rx_parse(uint8_t v);
+
 void receive_isr() {
-    PIR1bits.RC1IF = 0;      // Acknowledge interrupt
-    buf_push(RCREG1, INBUF); // Buffer incoming byte
+    PIR1bits.RC1IF = 0; // Acknowledge interrupt
+    rx_parse(RCREG1);   // Decode byte, complete commands go to cmd_queue
 }
+#else
+void receive_isr() {
+    PIR1bits.RC1IF = 0;        // Acknowledge interrupt
+    ring_push(&inbuf, RCREG1); // Buffer incoming byte
+    sched_post(TASK_PACKET);
+}
+#endif
 
+/*
+ * The transmitter stays enabled; TX1IE alone gates the pipeline.
+ * write_to_output queues a whole frame and sets TX1IE, then every TX1IF
+ * (TXREG1 empty) moves one byte into TXREG1. Loading TXREG1 clears TX1IF
+ * in hardware, so there is nothing to acknowledge and nothing to wait for.
+ * When outbuf runs dry TX1IE is cleared until the next frame is queued.
+ */
 void transmit_isr() {
-    PIR1bits.TX1IF = 0;    // Acknowledge interrupt
-    // If all bytes are transmitted, turn off transmission
-    if (buf_isempty(OUTBUF)) {
-        TXSTA1bits.TXEN = 0;
-    }
-    // Otherwise, send next byte
-    else {
-        TXREG1 = buf_pop(OUTBUF);
+    if (ring_isempty(&outbuf)) {
+        PIE1bits.TX1IE = 0;
+    } else {
+        TXREG1 = ring_pop(&outbuf);
     }
-    while (TXSTA1bits.TRMT == 0);
 }
 
+// Timer0 reload 0x85EE with a 1:32 prescaler: 100 ms at 10 MIPS
+#define TIMER0_PERIOD_CYCLES 1000000UL
+
 /*
  * cmd1 is sent in this procedure. It is first set to be DST, if altitude or
  * manual modes are on, cmd1 is changed. should_send represents whether the
@@ -117,6 +144,7 @@ void transmit_isr() {
  * input.
  */
 void handle_timer() {
+    PROF_BEGIN(PROF_TIMER);
     INTCONbits.TMR0IF = 0;
        
     cmd1.type = DISTANCE;
@@ -125,9 +153,7 @@ void handle_timer() {
     if (alt_period != 0) {
         if (timer_counter % alt_period == 0) {
             cmd1.type = ALTITUDE;
-            cmd1.value = adc_val;
-            GODONE = 1;
-           
+            cmd1.value = alt_values[alt_bin];
         }
     }
     
@@ -138,33 +164,52 @@ void handle_timer() {
     }
     
     if (should_send) {
+        PROF_BEGIN(PROF_WRITE_OUTPUT);
         write_to_output(&cmd1);
+        PROF_END(PROF_WRITE_OUTPUT);
+    }
+
+#ifdef PROFILE
+    if (should_send && ++prof_tick == PROF_REPORT_TICKS) {
+        prof_tick = 0;
+        write_stats(prof_probe);
+        prof_reset(&prof_stats[prof_probe]);
+        if (++prof_probe == PROF_COUNT) prof_probe = 0;
+
+        // sched_busy is only written by sched_idle with interrupts off
+        uint32_t busy = sched_busy / (PROF_REPORT_TICKS * (TIMER0_PERIOD_CYCLES / 100));
+        command_t idle = {.type = IDLE, .value = busy < 100 ? 100 - (int) busy : 0};
+        write_to_output(&idle);
+        sched_busy = 0;
     }
+#endif
 
     timer_counter++;
     
     TMR0H = 0x85;
     TMR0L = 0xEE;
+    PROF_END(PROF_TIMER);
 }
 
 /*
- * Handle Analog to Digital conversion.
+ * Handle Analog to Digital conversion. Accumulates one sample and, at the
+ * end of a window, publishes the bin of the average. The bin edges are at
+ * 256, 512 and 768.
  */
 void handle_adc() {
     PIR1bits.ADIF = 0;
     
-    unsigned int adcResult = (ADRESH << 8) + ADRESL;
-
-    if (adcResult < 256) {
-        adc_val = 9000;
-    } else if (adcResult < 512) {
-        adc_val = 10000;
-    } else if (adcResult < 768) {
-        adc_val = 11000;
-    } else {
-        adc_val = 12000;
-    }
-    
+    adc_sum += (uint16_t) ((ADRESH << 8) | ADRESL);
+    if (++adc_samples < (1 << ADC_OVERSAMPLE_SHIFT)) return;
+
+    uint16_t avg = adc_sum >> ADC_OVERSAMPLE_SHIFT;
+    adc_sum = 0;
+    adc_samples = 0;
+
+    uint8_t bin = alt_bin;
+    while (bin < 3 && avg >= ((uint16_t) (bin + 1) << 8) + ADC_HYSTERESIS) bin++;
+    while (bin > 0 && avg + ADC_HYSTERESIS < ((uint16_t) bin << 8)) bin--;
+    alt_bin = bin;
 }
 
 /*
@@ -212,11 +257,14 @@ void handle_portb() {
 }
 
 void __interrupt(high_priority) highPriorityISR(void) {
+    PROF_BEGIN(PROF_ISR);
     if (PIR1bits.RC1IF) receive_isr();
-    if (PIR1bits.TX1IF) transmit_isr();
+    // TX1IF stays set while TXREG1 is empty, so only act on it when enabled
+    if (PIE1bits.TX1IE && PIR1bits.TX1IF) transmit_isr();
     if (PIR1bits.ADIF) handle_adc();
     if (INTCONbits.RBIF) handle_portb();
     if (INTCONbits.TMR0IF) handle_timer();
+    PROF_END(PROF_ISR);
 }
 void __interrupt(low_priority) lowPriorityISR(void) {}
 
@@ -235,7 +283,7 @@ void init_ports() {
 
 void init_serial() {
     TXSTA1bits.TX9 = 0;    // No 9th bit
-    TXSTA1bits.TXEN = 0;   // Transmission is disabled for the time being
+    TXSTA1bits.TXEN = 1;   // Always on, transmit_isr is gated by TX1IE
     TXSTA1bits.SYNC = 0; 
     TXSTA1bits.BRGH = 1;
     RCSTA1bits.SPEN = 1;   // Enable serial port
@@ -248,9 +296,9 @@ void init_serial() {
 }
 
 void init_interrupts() {
-    // Enable reception and transmission interrupts
+    // Enable reception interrupts, write_to_output enables transmission
     INTCON = 0x00;
-    enable_rxtx();
+    PIE1bits.RC1IE = 1;
     INTCONbits.PEIE = 1;
     INTCONbits.TMR0IE = 1;
     disable_portb();
@@ -270,6 +318,10 @@ void init_timer() {
 
     TMR0H = 0x85;
     TMR0L = 0xEE;
+
+#ifdef PROFILE
+    prof_init(); // Timer1 as the cycle counter
+#endif
 }
 
 void init_adcon() {
@@ -280,16 +332,34 @@ void init_adcon() {
     ADCON2 = 0x00;
     
     ADCON2bits.ADFM = 1;
-    ADCON2 = 0xAA;
+    ADCON2 = 0xAA; // Right justified, 12 TAD acquisition, Fosc/32
+
+    // Timer3 clocks CCP2 (T3CCP2:T3CCP1 = 01), Timer1 stays free for
+    // profile.h. Prescaler 1:8, off until enable_adc.
+    T3CON = 0x38;
+    CCPR2H = ADC_SAMPLE_TICKS >> 8;
+    CCPR2L = ADC_SAMPLE_TICKS & 0xFF;
 }
 
 void enable_adc() {
+    // An earlier ALT may have left the conversions running. Stop them before
+    // the window is reset, handle_adc would race the 16-bit adc_sum writes
+    PIE1bits.ADIE = 0;
+    T3CONbits.TMR3ON = 0;
+    adc_sum = 0;
+    adc_samples = 0;
     ADCON0bits.ADON = 1;
+    PIR1bits.ADIF = 0;
     PIE1bits.ADIE = 1;
-    GODONE = 1;
+    TMR3H = 0;
+    TMR3L = 0;
+    CCP2CON = 0x0B; // Compare mode, special event trigger
+    T3CONbits.TMR3ON = 1;
 }
 
 void disable_adc() {
+    T3CONbits.TMR3ON = 0;
+    CCP2CON = 0x00;
     ADCON0bits.ADON = 0;
     PIE1bits.ADIE = 0;
 }
@@ -306,7 +376,10 @@ void disable_portb() {
     INTCONbits.RBIE = 0;
 }
 
-void start_system() { INTCONbits.GIE = 1; }
+void start_system() {
+    OSCCONbits.IDLEN = 1; // SLEEP stops the CPU only, see sched_idle
+    INTCONbits.GIE = 1;
+}
 
 /* **** Packet task **** */
 #define PKT_HEADER '$'  // Marker for start-of-packet
@@ -327,162 +400,435 @@ uint8_t val_data[5] = {0};
 // holds input command value length
 uint8_t cmd_val_len = 4;
 
+/* **** Binary framing **** */
 /*
- * returns 1 if equal, 0 otherwise
- * compares first three characters only, no bounds check
+ * Sending $GOBxxxx# instead of $GOOxxxx# starts the flight in binary mode:
+ * every later frame, in both directions, is BIN_SOF, the payload length,
+ * a 1-byte opcode and the raw little-endian payload. The opcode is the
+ * command_type_t value, so $DST1f40# (9 bytes) becomes A5 02 06 40 1F.
  */
-int string_compare_3(const uint8_t* a, const uint8_t* b)
-{
-    for (int i = 0; i < 3; ++i)
-    {
-        if (a[i] != b[i])
-        {
-            return 0;
+#define BIN_SOF 0xA5
+#define BIN_OPCODES 10 // GOO..IDLE
+
+// The receive side switches as soon as the GOB frame is decoded, before
+// the next byte arrives. The transmit side switches when GOB is executed.
+uint8_t rx_binary = 0;
+uint8_t tx_binary = 0;
+
+/* **** Command table **** */
+/*
+ * Everything the firmware knows about a command lives in cmd_table,
+ * indexed by command_type_t: its 3-letter ID, the length of its value in
+ * both framings, how to parse an ASCII value and what to do on reception.
+ * A received ID is found with one hash and one 3-byte compare in
+ * cmd_lookup, whatever the number of commands.
+ */
+typedef uint8_t (*cmd_parser_t)(const uint8_t* val, int* value);
+typedef void (*cmd_handler_t)(int value);
+
+typedef struct {
+    uint8_t id[3];
+    uint8_t val_len;      // Hex digits of the value in an ASCII frame
+    uint8_t bin_len;      // Payload bytes in a binary frame
+    cmd_parser_t parse;   // Decodes the ASCII value, NULL if it has none
+    cmd_handler_t handle; // Executes a received command, NULL if the
+                          // firmware only sends it
+} cmd_entry_t;
+
+uint8_t cmd_parse_hex2(const uint8_t* val, int* value) {
+    uint8_t v;
+    if (!hex_decode2(val, &v)) return 0;
+    *value = v;
+    return 1;
+}
+
+uint8_t cmd_parse_hex4(const uint8_t* val, int* value) {
+    uint16_t v;
+    if (!hex_decode4(val, &v)) return 0;
+    *value = (int) v;
+    return 1;
+}
+
+void cmd_go(int value) {
+    remaining_distance = value - speed;
+    should_send = 1;
+}
+
+void cmd_go_binary(int value) {
+    tx_binary = 1;
+    cmd_go(value);
+}
+
+void cmd_end(int value) {
+    INTCONbits.GIE = 0;
+}
+
+void cmd_speed(int value) {
+    speed = value;
+    remaining_distance -= speed;
+}
+
+void cmd_altitude(int value) {
+    alt_period = value / 100;
+    timer_counter = 1;
+    if (alt_period != 0) {
+        enable_adc();
+    } else {
+        disable_adc();
+    }
+}
+
+void cmd_manual(int value) {
+    manual_on = value;
+    if (manual_on) enable_portb();
+    else disable_portb();
+}
+
+void cmd_led(int value) {
+    switch (value) {
+        case 0:
+            PORTA = 0; PORTB = 0; PORTC = 0; PORTD = 0;
+            break;
+        case 1:
+            PORTD = 0x01;
+            break;
+        case 2:
+            PORTC = 0x01;
+            break;
+        case 3:
+            PORTB = 0x01;
+            break;
+        case 4:
+            PORTA = 0x01;
+            break;
+    }
+}
+
+const cmd_entry_t cmd_table[UNDEFINED] = {
+    [GOO]        = {"GOO", 4, 2, cmd_parse_hex4, cmd_go},
+    [END]        = {"END", 0, 0, NULL, cmd_end},
+    [SPEED]      = {"SPD", 4, 2, cmd_parse_hex4, cmd_speed},
+    [ALTITUDE]   = {"ALT", 4, 2, cmd_parse_hex4, cmd_altitude},
+    [MANUAL]     = {"MAN", 2, 1, cmd_parse_hex2, cmd_manual},
+    [LED]        = {"LED", 2, 1, cmd_parse_hex2, cmd_led},
+    [DISTANCE]   = {"DST", 4, 2, cmd_parse_hex4, NULL},
+    [PRESS]      = {"PRS", 2, 1, cmd_parse_hex2, NULL},
+    // probe, min, max, count and total, see write_stats
+    [STATS]      = {"STA", 24, 13, NULL, NULL},
+    [IDLE]       = {"IDL", 2, 1, cmd_parse_hex2, NULL},
+    // ASCII only, binary frames stop at BIN_OPCODES
+    [GOO_BINARY] = {"GOB", 4, 2, cmd_parse_hex4, cmd_go_binary},
+};
+
+/*
+ * Hash of a 3-byte ID, collision free for every ID in cmd_table. A new
+ * command needs a free slot in cmd_index; if it collides, change the hash.
+ */
+#define CMD_HASH(id) (((id)[0] + (id)[1] + ((id)[2] << 1)) & 0x1F)
+
+const uint8_t cmd_index[32] = {
+    UNDEFINED, UNDEFINED, UNDEFINED,  UNDEFINED,
+    UNDEFINED, IDLE,      UNDEFINED,  UNDEFINED,
+    PRESS,     STATS,     MANUAL,     SPEED,
+    UNDEFINED, UNDEFINED, UNDEFINED,  UNDEFINED,
+    UNDEFINED, UNDEFINED, UNDEFINED,  UNDEFINED,
+    GOO,       ALTITUDE,  UNDEFINED,  UNDEFINED,
+    UNDEFINED, LED,       GOO_BINARY, END,
+    UNDEFINED, UNDEFINED, UNDEFINED,  DISTANCE
+};
+
+/*
+ * Returns the command with the given 3-letter ID, UNDEFINED if there is none.
+ */
+command_type_t cmd_lookup(const uint8_t* id) {
+    uint8_t type = cmd_index[CMD_HASH(id)];
+    if (type != UNDEFINED) {
+        const uint8_t* e = cmd_table[type].id;
+        if (e[0] == id[0] && e[1] == id[1] && e[2] == id[2]) {
+            return (command_type_t) type;
         }
     }
-    return 1;
+    return UNDEFINED;
 }
 
 /*
  * Calculates the required amount of number characters for a given command
- * prefix.
+ * prefix. Commands the firmware does not accept are UNDEFINED.
  */
 int cmd_len(const uint8_t* cmd_data, command_t* cmd) {
-    if (string_compare_3(cmd_data, "GOO")) {
-        cmd->type = GOO;
-        return 4;
-    }
-    else if (string_compare_3(cmd_data, "END")) {
-        cmd->type = END;
-        return 0;
-    }
-    else if (string_compare_3(cmd_data, "SPD")) {
-        cmd->type = SPEED;
-        return 4;
-    }
-    else if (string_compare_3(cmd_data, "ALT")) {
-        cmd->type = ALTITUDE;
-        return 4;
-    }
-    else if (string_compare_3(cmd_data, "MAN")) {
-        cmd->type = MANUAL;
-        return 2;
-    }
-    else if (string_compare_3(cmd_data, "LED")) {
-        cmd->type = LED;
-        return 2;
-    }
-    else {
+    cmd->type = cmd_lookup(cmd_data);
+    if (cmd->type == UNDEFINED || !cmd_table[cmd->type].handle) {
         cmd->type = UNDEFINED;
         return -1;
     }
+    return cmd_table[cmd->type].val_len;
 }
 
 /*
  * Executes the command logic.
  */
 void process_cmd(const command_t* cmd) {
-    switch(cmd->type) {
-        case GOO:
-            remaining_distance = cmd->value - speed;
-            should_send = 1;
-            break;
-        case END:
-            INTCONbits.GIE = 0;
-            break;
-        case SPEED:
-            speed = cmd->value;
-            remaining_distance -= speed;
-            break;
-        case ALTITUDE:
-            alt_period = cmd->value / 100;
-            timer_counter = 1;
-            if (alt_period != 0) {
-                enable_adc();
-            } else {
-                disable_adc();
-            }
-            break;
-        case MANUAL:
-            manual_on = cmd->value;
-            if (manual_on) enable_portb();
-            else disable_portb();
-            break;
-        case LED:
-            switch (cmd->value) {
-                case 0:
-                    PORTA = 0; PORTB = 0; PORTC = 0; PORTD = 0;
-                    break;
-                case 1:
-                    PORTD = 0x01;
-                    break;
-                case 2:
-                    PORTC = 0x01;
-                    break;
-                case 3:
-                    PORTB = 0x01;
-                    break;
-                case 4:
-                    PORTA = 0x01;
-                    break;
-            }
-            break;
-        default:
+    cmd_handler_t handle = cmd_table[cmd->type].handle;
+    if (handle) handle(cmd->value);
+}
+
+typedef enum {BIN_WAIT_SOF, BIN_GET_LEN, BIN_GET_OPCODE, BIN_GET_PAYLOAD} bin_state_t;
+bin_state_t bin_state = BIN_WAIT_SOF;
+uint8_t bin_len;   // Payload length of the current frame
+uint8_t bin_count; // Payload bytes received so far
+
+/*
+ * Feeds one byte to the binary frame decoder. Returns 1 when cmd holds a
+ * complete command, 0 otherwise. Frames whose length does not match the
+ * opcode are dropped, and so are frames of commands the firmware only sends
+ * and frames whose payload does not fit in an int.
+ */
+uint8_t bin_parse(uint8_t v, command_t* cmd) {
+    switch (bin_state) {
+    case BIN_WAIT_SOF:
+        if (v == BIN_SOF) bin_state = BIN_GET_LEN;
+        break;
+    case BIN_GET_LEN:
+        bin_len = v;
+        bin_state = BIN_GET_OPCODE;
+        break;
+    case BIN_GET_OPCODE:
+        if (v >= BIN_OPCODES || !cmd_table[v].handle
+            || cmd_table[v].bin_len != bin_len || bin_len > sizeof(int)) {
+            /*error_packet();*/
+            bin_state = BIN_WAIT_SOF;
             break;
+        }
+        cmd->type = (command_type_t) v;
+        cmd->value = 0;
+        bin_count = 0;
+        if (bin_len == 0) {
+            bin_state = BIN_WAIT_SOF;
+            return 1;
+        }
+        bin_state = BIN_GET_PAYLOAD;
+        break;
+    case BIN_GET_PAYLOAD:
+        cmd->value |= (int) ((unsigned) v << (8 * bin_count));
+        if (++bin_count == bin_len) {
+            bin_state = BIN_WAIT_SOF;
+            return 1;
+        }
+        break;
     }
+    return 0;
 }
 
 /*
  * Writes the command to the output buffer, which will later be sent via
- * serial communication protocols.
+ * serial communication protocols. Frames are queued whole: if outbuf
+ * cannot take all of it the frame is dropped and counted instead.
  */
 void write_to_output(const command_t* cmd) {
-    buf_push('$', OUTBUF);
-    int i = cmd->value;
-    char hex[5] = {0};
-    switch (cmd->type) {
-        case DISTANCE:
-        {
-            buf_push('D', OUTBUF);
-            buf_push('S', OUTBUF);
-            buf_push('T', OUTBUF);
-            sprintf(hex, "%04x", cmd->value);
-            for (int j = 0; j < 4; ++j) {
-                buf_push(hex[j], OUTBUF);
+    const cmd_entry_t* e = &cmd_table[cmd->type];
+    uint8_t len;
+    if (tx_binary) {
+        len = 3 + e->bin_len; // SOF + length + opcode + payload
+    } else {
+        len = 5 + e->val_len; // $ + id + value + #
+    }
+    if (RING_SIZE - ring_count(&outbuf) < len) {
+        tx_frames_dropped++;
+        return;
+    }
+    if (tx_binary) {
+        ring_push(&outbuf, BIN_SOF);
+        ring_push(&outbuf, e->bin_len);
+        ring_push(&outbuf, (uint8_t) cmd->type);
+        ring_push(&outbuf, (uint8_t) cmd->value);
+        if (e->bin_len == 2) {
+            ring_push(&outbuf, (uint8_t) ((uint16_t) cmd->value >> 8));
+        }
+    } else {
+        uint8_t hex[4];
+        ring_push(&outbuf, '$');
+        ring_push(&outbuf, e->id[0]);
+        ring_push(&outbuf, e->id[1]);
+        ring_push(&outbuf, e->id[2]);
+        if (e->val_len == 4) {
+            hex_encode4((uint16_t) cmd->value, hex);
+        } else {
+            hex_encode2((uint8_t) cmd->value, hex);
+        }
+        for (uint8_t j = 0; j < e->val_len; ++j) {
+            ring_push(&outbuf, hex[j]);
+        }
+        ring_push(&outbuf, '#');
+    }
+
+    // ring_push(&outbuf, '#'); // junk char
+    PIE1bits.TX1IE = 1; // Start, or keep, the TX1IF pipeline running
+}
+
+#ifdef PROFILE
+/*
+ * Sends one probe of prof_stats as $STAppmmmmMMMMccccccccTTTTTTTT#: probe,
+ * min, max, count and total cycles, or as a binary STATS frame with the
+ * same fields. min is ffff when the probe was not hit since its last report.
+ */
+void write_stats(uint8_t probe) {
+    const prof_stat_t* st = &prof_stats[probe];
+    const cmd_entry_t* e = &cmd_table[STATS];
+    uint8_t len = tx_binary ? 3 + e->bin_len : 5 + e->val_len;
+    if (RING_SIZE - ring_count(&outbuf) < len) {
+        tx_frames_dropped++;
+        return;
+    }
+    if (tx_binary) {
+        ring_push(&outbuf, BIN_SOF);
+        ring_push(&outbuf, e->bin_len);
+        ring_push(&outbuf, (uint8_t) STATS);
+        ring_push(&outbuf, probe);
+        ring_push(&outbuf, (uint8_t) st->min);
+        ring_push(&outbuf, (uint8_t) (st->min >> 8));
+        ring_push(&outbuf, (uint8_t) st->max);
+        ring_push(&outbuf, (uint8_t) (st->max >> 8));
+        for (uint8_t j = 0; j < 32; j += 8) {
+            ring_push(&outbuf, (uint8_t) (st->count >> j));
+        }
+        for (uint8_t j = 0; j < 32; j += 8) {
+            ring_push(&outbuf, (uint8_t) (st->total >> j));
+        }
+    } else {
+        uint8_t hex[4];
+        ring_push(&outbuf, '$');
+        ring_push(&outbuf, e->id[0]);
+        ring_push(&outbuf, e->id[1]);
+        ring_push(&outbuf, e->id[2]);
+        hex_encode2(probe, hex);
+        ring_push(&outbuf, hex[0]);
+        ring_push(&outbuf, hex[1]);
+        const uint16_t fields[6] = {
+            st->min, st->max,
+            (uint16_t) (st->count >> 16), (uint16_t) st->count,
+            (uint16_t) (st->total >> 16), (uint16_t) st->total
+        };
+        for (uint8_t i = 0; i < 6; ++i) {
+            hex_encode4(fields[i], hex);
+            for (uint8_t j = 0; j < 4; ++j) {
+                ring_push(&outbuf, hex[j]);
             }
-            break;
         }
-        case ALTITUDE:
-        {
-            buf_push('A', OUTBUF);
-            buf_push('L', OUTBUF);
-            buf_push('T', OUTBUF);
-            sprintf(hex, "%04x", cmd->value);
-            for (int j = 0; j < 4; ++j) {
-                buf_push(hex[j], OUTBUF);
+        ring_push(&outbuf, '#');
+    }
+    PIE1bits.TX1IE = 1;
+}
+#endif
+
+#ifdef RX_PARSE_IN_ISR
+/*
+ * Alternative receive path: receive_isr feeds every byte to rx_parse,
+ * which decodes the frame incrementally (the value is accumulated one hex
+ * digit at a time) and queues complete commands in cmd_queue. packet_task
+ * then only has to execute them, one per main loop pass.
+ */
+#define CMDQ_SIZE 4 /* Must be a power of two */
+#define CMDQ_MASK (CMDQ_SIZE - 1)
+
+// Single-producer (receive_isr) / single-consumer (packet_task) queue
+typedef struct {
+    command_t cmd[CMDQ_SIZE];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    uint8_t overflow; // Commands dropped because the queue was full
+} cmd_queue_t;
+
+cmd_queue_t cmd_queue;
+
+typedef enum {RX_WAIT_HEADER, RX_GET_ID, RX_GET_VALUE} rx_state_t;
+rx_state_t rx_state = RX_WAIT_HEADER;
+uint8_t rx_count;      // Characters of the current field received so far
+uint16_t rx_value;     // Value decoded so far
+command_t rx_cmd;      // Command being decoded
+
+void cmd_queue_push(const command_t* cmd) {
+    uint8_t head = cmd_queue.head;
+    if ((uint8_t) (head - cmd_queue.tail) >= CMDQ_SIZE) {
+        cmd_queue.overflow++;
+        return;
+    }
+    cmd_queue.cmd[head & CMDQ_MASK] = *cmd;
+    cmd_queue.head = head + 1; // Publish after the command is stored
+    sched_post(TASK_PACKET);
+}
+
+void rx_parse(uint8_t v) {
+    if (rx_binary) {
+        if (bin_parse(v, &rx_cmd)) cmd_queue_push(&rx_cmd);
+        return;
+    }
+    if (v == PKT_HEADER) {
+        // Start of a packet, aborting any unfinished one
+        rx_state = RX_GET_ID;
+        rx_count = 0;
+        return;
+    }
+    switch (rx_state) {
+    case RX_WAIT_HEADER:
+        break;
+    case RX_GET_ID:
+        cmd_data[rx_count++] = v;
+        if (rx_count == 3) {
+            int len = cmd_len(cmd_data, &rx_cmd);
+            if (len < 0) {
+                /*error_packet();*/
+                rx_state = RX_WAIT_HEADER;
+                break;
             }
-            break;
+            cmd_val_len = (uint8_t) len;
+            rx_count = 0;
+            rx_value = 0;
+            rx_state = RX_GET_VALUE;
         }
-        case PRESS:
-        {
-            buf_push('P', OUTBUF);
-            buf_push('R', OUTBUF);
-            buf_push('S', OUTBUF);
-            sprintf(hex, "%02x", cmd->value);
-            for (int j = 0; j < 2; ++j) {
-                buf_push(hex[j], OUTBUF);
+        break;
+    case RX_GET_VALUE:
+        if (v == PKT_END) {
+            rx_state = RX_WAIT_HEADER;
+            if (rx_count != cmd_val_len) {
+                /*error_packet();*/
+                break;
             }
-            break;
+            rx_cmd.value = (int) rx_value;
+            if (rx_cmd.type == GOO_BINARY) rx_binary = 1;
+            cmd_queue_push(&rx_cmd);
+        } else {
+            uint8_t nibble = hex_nibble(v);
+            if (nibble == HEX_INVALID || rx_count == cmd_val_len) {
+                /*error_packet();*/
+                rx_state = RX_WAIT_HEADER;
+                break;
+            }
+            rx_value = (uint16_t) ((rx_value << 4) | nibble);
+            rx_count++;
         }
+        break;
     }
-    buf_push('#', OUTBUF);
+}
 
-    // buf_push('#', OUTBUF); // junk char
+void packet_task() {
+    uint8_t tail = cmd_queue.tail;
+    if (tail == cmd_queue.head) return;
+    process_cmd(&cmd_queue.cmd[tail & CMDQ_MASK]);
+    cmd_queue.tail = tail + 1;
 }
 
+// 1 if packet_task has more to do
+uint8_t packet_pending() {
+    return cmd_queue.tail != cmd_queue.head;
+}
+#else
 void packet_task() {
-    disable_rxtx();
     uint8_t v;
+    if (rx_binary) {
+        if (ring_isempty(&inbuf)) return;
+        if (bin_parse(ring_pop(&inbuf), &input_cmd)) process_cmd(&input_cmd);
+        return;
+    }
     /*
      * The finite state machine has three states. The first state is waiting for
      * dollar sign. If it receives the dollar sign, then it receives the body.
@@ -493,18 +839,16 @@ void packet_task() {
     switch(pkt_state) {
     // wait for $
     case PKT_WAIT_HEADER:
-        if (buf_isempty(INBUF)) break;
-        v = buf_pop(INBUF);
-        enable_rxtx();
+        if (ring_isempty(&inbuf)) break;
+        v = ring_pop(&inbuf);
         if (v == PKT_HEADER) {
             pkt_state = PKT_GET_BODY;
             pkt_bodysize = 0;
         }
         break;
     case PKT_GET_BODY:
-        if (buf_isempty(INBUF)) break;
-        v = buf_pop(INBUF);
-        enable_rxtx();
+        if (ring_isempty(&inbuf)) break;
+        v = ring_pop(&inbuf);
         if (v == PKT_END) {
             if (pkt_bodysize != 3 + cmd_val_len) {
                 /*error_packet();*/
@@ -520,64 +864,94 @@ void packet_task() {
         } else {
             if (pkt_bodysize < 3) {
                 cmd_data[pkt_bodysize] = v;
-            } else if (pkt_bodysize == 3) {
-                cmd_val_len = cmd_len(cmd_data, &input_cmd);
-                val_data[0] = v;
-            } else if (pkt_bodysize < 3 + cmd_val_len) {
+                // Resolve the ID as soon as it is complete, so that
+                // commands without a value (END) pass the length check
+                if (pkt_bodysize == 2) {
+                    int len = cmd_len(cmd_data, &input_cmd);
+                    if (len < 0) {
+                        // Unknown ID, drop the rest of the packet
+                        /*error_packet();*/
+                        pkt_state = PKT_WAIT_HEADER;
+                        break;
+                    }
+                    cmd_val_len = (uint8_t) len;
+                }
+            } else if (pkt_bodysize < 3 + cmd_val_len && pkt_bodysize - 3 < sizeof val_data) {
                 val_data[pkt_bodysize - 3] = v;
             } else {
                 // error
             }
             pkt_bodysize++;
         }
-        break;
+        // Acknowledge in the same call that read the '#', so that every
+        // call consumes a byte and the main loop keeps up with back-to-back
+        // frames at one pass per received byte
+        if (pkt_state != PKT_WAIT_ACK) break;
+        // fall through
     case PKT_WAIT_ACK:
-        enable_rxtx();
-        if (cmd_val_len == 2) {
-            sscanf(val_data, "%02x", &input_cmd.value);
-        } else if (cmd_val_len == 4) {
-            sscanf(val_data, "%04x", &input_cmd.value);
+    {
+        // Drop the packet if its value field is not valid hex
+        cmd_parser_t parse = cmd_table[input_cmd.type].parse;
+        if (parse && !parse(val_data, &input_cmd.value)) {
+            /*error_packet();*/
+            pkt_state = PKT_WAIT_HEADER;
+            break;
         }
+        if (input_cmd.type == GOO_BINARY) rx_binary = 1;
         process_cmd(&input_cmd);
         pkt_state = PKT_WAIT_HEADER;
         break;
     }
+    }
 }
 
-typedef enum {OUTPUT_INIT, OUTPUT_RUN} output_st_t;
-output_st_t output_st = OUTPUT_INIT;
-/* Output task function */
-void output_task() {
-    disable_rxtx();   
-    if (!buf_isempty(OUTBUF) && TXSTA1bits.TXEN == 0) {
-         // If transmission is already ongoing, do nothing, 
-         // the ISR will send the next char. Otherwise, send the 
-         // first char and enable transmission
-         TXSTA1bits.TXEN = 1;
-         TXREG1 = buf_pop(OUTBUF);
-     }
-     enable_rxtx();
+// 1 if packet_task has more to do
+uint8_t packet_pending() {
+    return !ring_isempty(&inbuf) || pkt_state == PKT_WAIT_ACK;
 }
+#endif
 
 /*
-void adc_task() {
-    if (alt_period == 0) return;
-    
-    GODONE = 1;
-    while (GODONE);
-    unsigned int result = (ADRES << 8) + ADRESL;
-    
-    if (result < 256) {
-        adc_val = 9000;
-    } else if (result < 512) {
-        adc_val = 10000;
-    } else if (result < 768) {
-        adc_val = 11000;
-    } else {
-        adc_val = 12000;
+ * Runs every posted task once. A task's bit is cleared before it runs, so
+ * a post made while it runs is not lost. packet_task handles one byte or
+ * command per call and is posted again while it has more to do.
+ */
+void sched_run() {
+    if (sched_ready & TASK_PACKET) {
+        sched_ready &= ~TASK_PACKET;
+        PROF_BEGIN(PROF_PACKET_TASK);
+        packet_task();
+        PROF_END_MAIN(PROF_PACKET_TASK);
+        if (packet_pending()) sched_post(TASK_PACKET);
     }
 }
+
+/*
+ * Puts the core in IDLE mode until the next interrupt if no task is
+ * posted. GIE is cleared for the check, so an interrupt that posts a task
+ * between the check and SLEEP cannot be missed: with GIE = 0 an enabled
+ * interrupt still ends SLEEP, and its handler runs once GIE is restored.
+ * With PROFILE the cycles spent awake are added to sched_busy here too.
  */
+void sched_idle() {
+    uint8_t gie = INTCONbits.GIE;
+    INTCONbits.GIE = 0;
+#ifdef PROFILE
+    uint16_t now = prof_now();
+    sched_busy += (uint16_t) (now - sched_busy_t0);
+#endif
+    if (!sched_ready) {
+        SLEEP();
+        NOP();
+#ifdef PROFILE
+        now = prof_now();
+#endif
+    }
+#ifdef PROFILE
+    sched_busy_t0 = now;
+#endif
+    INTCONbits.GIE = gie;
+}
 
 void main(void) {
     init_ports();
@@ -588,9 +962,8 @@ void main(void) {
     start_system();
     
     while(1) {
-        //adc_task();
-        packet_task();
-        output_task();
+        sched_run();
+        sched_idle();
     }
 
     return;
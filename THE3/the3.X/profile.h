@@ -0,0 +1,94 @@
+/*
+ * File:   profile.h
+ *
+ * Optional cycle instrumentation of the hot paths, enabled with -DPROFILE.
+ * Timer1 runs free at Fosc/4, so one count is one instruction cycle.
+ * PROF_BEGIN/PROF_END around a call record how long it took into
+ * prof_stats: minimum, maximum, number of calls and total cycles since the
+ * probe was last reported. handle_timer reports one probe as a $STA frame
+ * every PROF_REPORT_TICKS periods and then clears it.
+ *
+ * Without PROFILE every macro expands to nothing, prof_stats does not
+ * exist and Timer1 is left off.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include "hal.h"
+
+#ifdef PROFILE
+
+typedef enum {
+    PROF_ISR,          // highPriorityISR, all handlers included
+    PROF_TIMER,        // handle_timer, write_to_output included
+    PROF_PACKET_TASK,  // one packet_task call, interrupts included
+    PROF_WRITE_OUTPUT, // write_to_output
+    PROF_COUNT
+} prof_probe_t;
+
+// Timer periods between two $STA frames, each frame carries one probe
+#define PROF_REPORT_TICKS 5
+
+typedef struct {
+    uint16_t min;
+    uint16_t max;
+    uint32_t count;
+    uint32_t total;
+} prof_stat_t;
+
+extern prof_stat_t prof_stats[PROF_COUNT];
+
+static inline void prof_reset(prof_stat_t* s) {
+    s->min = 0xFFFF;
+    s->max = 0;
+    s->count = 0;
+    s->total = 0;
+}
+
+static inline void prof_init(void) {
+    T1CON = 0x00;         // Fosc/4, 1:1 prescaler
+    T1CONbits.RD16 = 1;   // Reading TMR1L latches TMR1H
+    T1CONbits.TMR1ON = 1;
+    for (uint8_t i = 0; i < PROF_COUNT; ++i) {
+        prof_reset(&prof_stats[i]);
+    }
+}
+
+static inline uint16_t prof_now(void) {
+    uint8_t lo = TMR1L; // Must be read first
+    return (uint16_t) ((TMR1H << 8) | lo);
+}
+
+static inline void prof_record(prof_stat_t* s, uint16_t cycles) {
+    if (cycles < s->min) s->min = cycles;
+    if (cycles > s->max) s->max = cycles;
+    s->count++;
+    s->total += cycles;
+}
+
+#define PROF_BEGIN(probe) uint16_t prof_t0_##probe = prof_now()
+#define PROF_END(probe) prof_record(&prof_stats[probe], (uint16_t) (prof_now() - prof_t0_##probe))
+/*
+ * For probes outside the ISR. handle_timer reads and clears prof_stats, so
+ * the update must not be interrupted halfway. GIE is restored rather than
+ * set because END turns interrupts off from packet_task.
+ */
+#define PROF_END_MAIN(probe)               \
+    do {                                   \
+        uint8_t prof_gie = INTCONbits.GIE; \
+        INTCONbits.GIE = 0;                \
+        PROF_END(probe);                   \
+        INTCONbits.GIE = prof_gie;         \
+    } while (0)
+
+#else
+
+#define PROF_BEGIN(probe)
+#define PROF_END(probe)
+#define PROF_END_MAIN(probe)
+
+#endif /* PROFILE */
+
+#endif /* PROFILE_H */
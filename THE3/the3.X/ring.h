@@ -0,0 +1,73 @@
+/*
+ * File:   ring.h
+ *
+ * Single-producer/single-consumer byte rings for the UART path. The head
+ * index is only written by the producer and the tail index only by the
+ * consumer, so an ISR and the main loop can share a ring without masking
+ * interrupts. Indices run freely over 0..255 and are masked on access,
+ * which keeps every slot usable and makes the fill level a single subtract.
+ *
+ * Each ring is pushed from one context and popped from the other, so the
+ * helpers are called from both the ISR and the main loop. They keep the
+ * interrupt_level pragma of the buffer functions they replaced; it is only
+ * known to XC8, the host build does not see it.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+#define RING_SIZE 128 /* Must be a power of two, at most 128 */
+#define RING_MASK (RING_SIZE - 1)
+
+typedef struct {
+    volatile uint8_t data[RING_SIZE];
+    volatile uint8_t head;  /* Next slot to write, producer only */
+    volatile uint8_t tail;  /* Next slot to read, consumer only */
+    uint16_t overflow;      /* Bytes dropped because the ring was full */
+    uint16_t underflow;     /* Pops attempted on an empty ring */
+    uint8_t high_water;     /* Highest fill level seen by the producer */
+} ring_t;
+
+/* Number of bytes waiting in the ring */
+static inline uint8_t ring_count(const ring_t* r) { return (uint8_t) (r->head - r->tail); }
+
+#ifdef __XC8
+#pragma interrupt_level 2 // Prevents duplication of function
+#endif
+static inline uint8_t ring_isempty(const ring_t* r) { return r->head == r->tail; }
+
+/* Producer side. Returns 0 and counts an overflow if the ring is full */
+#ifdef __XC8
+#pragma interrupt_level 2 // Prevents duplication of function
+#endif
+static inline uint8_t ring_push(ring_t* r, uint8_t v) {
+    uint8_t head = r->head;
+    uint8_t used = (uint8_t) (head - r->tail);
+    if (used >= RING_SIZE) {
+        r->overflow++;
+        return 0;
+    }
+    r->data[head & RING_MASK] = v;
+    r->head = head + 1; // Publish only after the data is in place
+    if (used >= r->high_water) r->high_water = used + 1;
+    return 1;
+}
+
+/* Consumer side. Returns 0 and counts an underflow if the ring is empty */
+#ifdef __XC8
+#pragma interrupt_level 2 // Prevents duplication of function
+#endif
+static inline uint8_t ring_pop(ring_t* r) {
+    uint8_t tail = r->tail;
+    if (tail == r->head) {
+        r->underflow++;
+        return 0;
+    }
+    uint8_t v = r->data[tail & RING_MASK];
+    r->tail = tail + 1;
+    return v;
+}
+
+#endif /* RING_H */
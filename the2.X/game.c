@@ -0,0 +1,214 @@
+/*
+ * File:   game.c
+ *
+ * The game rules, see game.h. Nothing in here touches a register, waits or
+ * knows about interrupts.
+ */
+
+#include "game.h"
+#include "piece_tables.h" // generated by gen_piece_tables.py
+
+#define bit char
+
+// Position of the tetromino after a move, see MovedMask for dir0, dir1
+#define MOVED_X(dir0, dir1) ((dir1) == 0 ? ((dir0) == 0 ? curTet.x - 1 : curTet.x + 1) : curTet.x)
+#define MOVED_Y(dir0, dir1) ((dir1) == 1 ? ((dir0) == 0 ? curTet.y + 1 : curTet.y - 1) : curTet.y)
+
+Tetromino curTet;
+Board board;
+Board buffer;
+
+char pieces = 0;
+char curTetDisplayed = 1;
+unsigned char dirty = ALL_COLUMNS;
+
+void MarkDirty(BoardWord mask);
+BoardWord PlacedMask(char orient, char x, char y);
+BoardWord MovedMask(bit dir0, bit dir1);
+void Move(bit dir0, bit dir1);
+void Rotate();
+char Submit();
+
+//Empty board, no score, a DOT at the top left corner
+void GameInit()
+{
+    board.word = 0;
+    pieces = 0;
+    curTetDisplayed = 1;
+    dirty = ALL_COLUMNS;
+    NewPiece(DOT_PIECE);
+}
+
+//Applies one event, returns GAME_SUBMITTED if it placed the piece
+char GameStep(char ev)
+{
+    switch (ev)
+    {
+        case GAME_BLINK:
+            curTetDisplayed ^= 0x01;
+            MarkDirty(curTet.mask.word);
+            break;
+        case GAME_GRAVITY:
+        case GAME_DOWN:
+            if (ShapeInBounds(0, 1)) Move(0, 1);
+            break;
+        case GAME_RIGHT:
+            if (ShapeInBounds(1, 0)) Move(1, 0);
+            break;
+        case GAME_LEFT:
+            if (ShapeInBounds(0, 0)) Move(0, 0);
+            break;
+        case GAME_UP:
+            if (ShapeInBounds(1, 1)) Move(1, 1);
+            break;
+        case GAME_ROTATE:
+            Rotate(); // DOT and SQUARE rotate onto themselves
+            break;
+        case GAME_SUBMIT:
+            return Submit();
+    }
+    return 0;
+}
+
+#define MARK_COLUMN(x) if (m.col[x]) dirty |= 1 << (x);
+
+//Marks the columns that mask has cells in
+void MarkDirty(BoardWord mask)
+{
+    Board m;
+    m.word = mask;
+
+    FOR_EACH_COLUMN(MARK_COLUMN)
+}
+
+//Recomposes the dirty columns of buffer and returns them
+unsigned char UpdateBuffer()
+{
+    if (dirty == 0)
+    {
+        return 0;
+    }
+
+    unsigned char cols = dirty;
+    dirty = 0;
+
+    unsigned char col = 0x01;
+    for (unsigned char x = 0; x < BOARD_WIDTH; x++, col <<= 1)
+    {
+        if (cols & col)
+        {
+            if (curTetDisplayed)
+            {
+                buffer.col[x] = board.col[x] | curTet.mask.col[x];
+            }
+            else
+            {
+                buffer.col[x] = board.col[x] & ~curTet.mask.col[x];
+            }
+        }
+    }
+
+    return cols;
+}
+
+//Spawns a piece in its first orientation at the top left corner
+void NewPiece(char type)
+{
+    curTet.type = type;
+    curTet.orient = pieceOrient[type];
+    curTet.x = 0;
+    curTet.y = 0;
+    curTet.mask.word = placeMask[curTet.orient][0][0];
+    MarkDirty(curTet.mask.word);
+}
+
+//Cells of an orientation at (x, y), 0 if any of them is off the board
+BoardWord PlacedMask(char orient, char x, char y)
+{
+    if ((unsigned char) x >= BOARD_WIDTH || (unsigned char) y >= BOARD_HEIGHT)
+    {
+        return 0;
+    }
+    return placeMask[orient][x][y];
+}
+
+/*
+ * dir0, dir1: 1, 0 > +x direction
+ * dir0, dir1: 0, 0 > -x direction
+ * dir0, dir1: 0, 1 > +y direction
+ * dir0, dir1: 1, 1 > -y direction
+ */
+BoardWord MovedMask(bit dir0, bit dir1)
+{
+    return PlacedMask(curTet.orient, MOVED_X(dir0, dir1), MOVED_Y(dir0, dir1));
+}
+
+//true if the moved tetromino would leave the board or overlap a placed piece
+char IsColliding(bit dir0, bit dir1)
+{
+    BoardWord moved = MovedMask(dir0, dir1);
+    return moved == 0 || (board.word & moved) != 0;
+}
+
+char IsSubmitable()
+{
+    return (board.word & curTet.mask.word) == 0;
+}
+
+char ShapeInBounds(bit dir0, bit dir1)
+{
+    return MovedMask(dir0, dir1) != 0;
+}
+
+void Move(bit dir0, bit dir1)
+{
+    MarkDirty(curTet.mask.word);
+    curTet.mask.word = MovedMask(dir0, dir1);
+    MarkDirty(curTet.mask.word);
+    curTet.x = MOVED_X(dir0, dir1);
+    curTet.y = MOVED_Y(dir0, dir1);
+}
+
+//Places the tetromino and spawns the next one, GAME_SUBMITTED if it fit
+char Submit()
+{
+    if (!IsSubmitable())
+    {
+        return 0;
+    }
+
+    board.word |= curTet.mask.word;
+    MarkDirty(curTet.mask.word);
+
+    switch (curTet.type)
+    {
+        case DOT_PIECE:
+            pieces++;
+            NewPiece(SQUARE_PIECE);
+            break;
+        case SQUARE_PIECE:
+            pieces += 4;
+            NewPiece(L_PIECE);
+            break;
+        case L_PIECE:
+            pieces += 3;
+            NewPiece(DOT_PIECE);
+            break;
+    }
+    curTetDisplayed = 0x01;
+    return GAME_SUBMITTED;
+}
+
+//Turns the tetromino a quarter clockwise if it still fits on the board
+void Rotate()
+{
+    char next = rotateNext[curTet.orient];
+    BoardWord mask = PlacedMask(next, curTet.x, curTet.y);
+
+    if (mask != 0)
+    {
+        MarkDirty(curTet.mask.word | mask);
+        curTet.orient = next;
+        curTet.mask.word = mask;
+    }
+}
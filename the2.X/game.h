@@ -0,0 +1,113 @@
+/*
+ * File:   game.h
+ *
+ * Rules of the THE2 game without any hardware: the board, the falling
+ * piece, its moves and rotations, submitting and the score. Everything
+ * happens through GameStep, one event at a time. main.c feeds it the
+ * debounced buttons and the blink and gravity timers and shows the result
+ * on the LEDs; host/replay.c feeds it recorded traces on a Linux machine.
+ */
+
+#ifndef GAME_H
+#define GAME_H
+
+#include <stdint.h>
+
+/*
+ * Board size in cells. 4x8 is the lab board. 8x8 and 4x16 are also
+ * supported, a column is one or two LAT bytes. Set both with -D for every
+ * file of the build; piece_tables.h has a placeMask for each size.
+ */
+#ifndef BOARD_WIDTH
+#define BOARD_WIDTH  4
+#endif
+#ifndef BOARD_HEIGHT
+#define BOARD_HEIGHT 8
+#endif
+
+#if BOARD_WIDTH == 4
+#define FOR_EACH_COLUMN(X) X(0) X(1) X(2) X(3)
+#elif BOARD_WIDTH == 8
+#define FOR_EACH_COLUMN(X) X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7)
+#else
+#error "BOARD_WIDTH must be 4 or 8"
+#endif
+
+#if BOARD_HEIGHT == 8
+typedef uint8_t BoardColumn;
+#elif BOARD_HEIGHT == 16
+typedef uint16_t BoardColumn;
+#else
+#error "BOARD_HEIGHT must be 8 or 16"
+#endif
+
+#if BOARD_WIDTH * BOARD_HEIGHT <= 32
+typedef uint32_t BoardWord;
+#else
+typedef uint64_t BoardWord;
+#endif
+
+// Bit x of every column, the value of dirty when all of them are stale
+#define ALL_COLUMNS ((unsigned char) ((1u << BOARD_WIDTH) - 1))
+
+// Periods in ticks (ms)
+#define BLINK_MS   250
+#define GRAVITY_MS 2000
+
+/*
+ * Events of GameStep. A button is numbered like its bit in the input byte
+ * main.c samples, so a press is passed on as is.
+ */
+#define GAME_RIGHT   0
+#define GAME_UP      2
+#define GAME_DOWN    3
+#define GAME_LEFT    4
+#define GAME_ROTATE  6
+#define GAME_SUBMIT  7
+#define GAME_BLINK   8
+#define GAME_GRAVITY 9
+
+// GameStep result: the piece was placed, pieces changed and a new one spawned
+#define GAME_SUBMITTED 0x01
+
+/*
+ * Bitboard, cell (x, y) is bit x * BOARD_HEIGHT + y. col[x] is column x
+ * and byte[] what goes to the LAT registers, top rows first (the PIC18 is
+ * little-endian). Piece masks come from placeMask in piece_tables.h.
+ */
+typedef union
+{
+    BoardWord word;
+    BoardColumn col[BOARD_WIDTH];
+    uint8_t byte[sizeof(BoardWord)];
+} Board;
+
+typedef struct
+{
+    char type;
+    char orient; // row of placeMask
+    char x, y; // position of top left corner
+    Board mask; // placeMask[orient][x][y]
+} Tetromino;
+
+extern Tetromino curTet;
+extern Board board;
+extern Board buffer;
+extern char pieces;
+
+// 1 if displayed, 0 o.w.
+extern char curTetDisplayed;
+
+// Bit x set: column x of buffer is stale and LAT of it must be rewritten
+extern unsigned char dirty;
+
+void GameInit();
+char GameStep(char ev);
+void NewPiece(char type);
+unsigned char UpdateBuffer();
+
+char IsColliding(char dir0, char dir1);
+char IsSubmitable();
+char ShapeInBounds(char dir0, char dir1);
+
+#endif /* GAME_H */
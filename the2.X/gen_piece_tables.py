@@ -0,0 +1,157 @@
+"""
+Generates piece_tables.h, the ROM lookup tables of the THE2 pieces.
+
+For every orientation of every piece and every position of its top left
+corner on the board, placeMask holds the board cells it covers as a
+bitboard (cell (x, y) is bit x * BOARD_HEIGHT + y), or 0 where a cell would
+be off the board. Moves, rotations and gravity steps in game.c are lookups
+in these tables instead of shape arithmetic.
+
+placeMask is written once for every board size in GEOMETRIES, each under
+its own #if, so the size game.h is compiled for picks its table.
+
+Run by the MPLAB X pre-build step and by host/Makefile:
+
+    python3 gen_piece_tables.py piece_tables.h
+"""
+import sys
+
+# (width, height) of the boards game.h supports
+GEOMETRIES = [(4, 8), (8, 8), (4, 16)]
+
+# Pieces in spawn order of their ids, each drawn in its square bounding box
+# with "#" for a cell. The first orientation is the one a piece spawns in,
+# rotating turns it a quarter clockwise.
+PIECES = [
+    ("DOT", ["#"]),
+    ("SQUARE", ["##",
+                "##"]),
+    ("L", ["##",
+           ".#"]),
+]
+
+
+def cells_of(rows):
+    """
+    (x, y) of every cell of a drawing
+    """
+    return frozenset((x, y) for y, row in enumerate(rows) for x, c in enumerate(row) if c == "#")
+
+
+def rotate(cells, size):
+    """
+    The cells turned a quarter clockwise inside their size x size box
+    """
+    return frozenset((size - 1 - y, x) for x, y in cells)
+
+
+def orientations(rows):
+    """
+    Distinct orientations of a piece, in rotation order
+    """
+    size = len(rows)
+    assert all(len(row) == size for row in rows), "pieces are drawn in a square box"
+    result = [cells_of(rows)]
+    while True:
+        nxt = rotate(result[-1], size)
+        if nxt == result[0]:
+            return result
+        result.append(nxt)
+
+
+def place(cells, x0, y0, width, height):
+    """
+    Bitboard of the cells with the top left corner at (x0, y0), 0 off the board
+    """
+    mask = 0
+    for x, y in cells:
+        x += x0
+        y += y0
+        if x >= width or y >= height:
+            return 0
+        mask |= 1 << (x * height + y)
+    return mask
+
+
+def place_mask(turns, width, height):
+    """
+    The placeMask definition of one board size
+    """
+    digits = width * height // 4
+    suffix = "ULL" if width * height > 32 else ""
+    out = ["const BoardWord placeMask[ORIENT_COUNT][%d][%d] = {" % (width, height)]
+    for o, cells in enumerate(turns):
+        out.append("    { // %d" % o)
+        for x in range(width):
+            column = [place(cells, x, y, width, height) for y in range(height)]
+            out.append("        {%s}," % ", ".join("0x%0*X%s" % (digits, m, suffix) for m in column))
+        out.append("    },")
+    out.append("};")
+    return out
+
+
+def generate():
+    first = []      # first orientation of each piece
+    rotate_next = []
+    turns = []      # cells of every orientation
+    for _, rows in PIECES:
+        base = len(turns)
+        piece = orientations(rows)
+        first.append(base)
+        for i, cells in enumerate(piece):
+            rotate_next.append(base + (i + 1) % len(piece))
+            turns.append(cells)
+
+    out = [
+        "/*",
+        " * File:   piece_tables.h",
+        " *",
+        " * Generated by gen_piece_tables.py, do not edit. Include it after",
+        " * game.h, which sets the board size and BoardWord.",
+        " *",
+        " * The tables are defined here, so only game.c includes it as is.",
+        " * Other files define PIECE_TABLES_NO_DATA first to get the constants.",
+        " */",
+        "",
+        "#ifndef PIECE_TABLES_H",
+        "#define PIECE_TABLES_H",
+        "",
+    ]
+    for i, (name, _) in enumerate(PIECES):
+        out.append("#define %s_PIECE %d" % (name, i))
+    out += [
+        "",
+        "#define PIECE_COUNT %d" % len(PIECES),
+        "#define ORIENT_COUNT %d" % len(turns),
+        "",
+        "#ifndef PIECE_TABLES_NO_DATA",
+        "",
+        "// Orientation each piece spawns in",
+        "const unsigned char pieceOrient[PIECE_COUNT] = {%s};" % ", ".join(map(str, first)),
+        "",
+        "// Orientation reached by one clockwise rotation",
+        "const unsigned char rotateNext[ORIENT_COUNT] = {%s};" % ", ".join(map(str, rotate_next)),
+        "",
+        "// Cells of an orientation with its top left corner at (x, y), 0 if one is off the board",
+    ]
+    for i, (width, height) in enumerate(GEOMETRIES):
+        out.append("#%s BOARD_WIDTH == %d && BOARD_HEIGHT == %d" % ("if" if i == 0 else "elif", width, height))
+        out += place_mask(turns, width, height)
+    out += [
+        "#else",
+        '#error "no piece tables for this board size, add it to GEOMETRIES in gen_piece_tables.py"',
+        "#endif",
+        "",
+        "#endif /* PIECE_TABLES_NO_DATA */",
+        "",
+        "#endif /* PIECE_TABLES_H */",
+        "",
+    ]
+    return "\n".join(out)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        sys.exit("usage: gen_piece_tables.py output.h")
+    with open(sys.argv[1], "w") as f:
+        f.write(generate())
@@ -0,0 +1,19 @@
+/*
+ * File:   hal.h
+ *
+ * Hardware abstraction for the special function registers used by main.c.
+ * When compiled with XC8 the real registers from <xc.h> are used. Any other
+ * compiler gets the mock register file in host/mock_sfr.h, so the game can
+ * be built and benchmarked on a Linux machine.
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#ifdef __XC8
+#include <xc.h>
+#else
+#include "host/mock_sfr.h"
+#endif
+
+#endif /* HAL_H */
@@ -0,0 +1,534 @@
+/*
+ * File:   bench.c
+ *
+ * Host benchmark for the THE2 game. A recorded input trace is replayed
+ * through the mock ports, one 250 ms blink period per trace line, made of
+ * 250 Timer2 interrupts that each run one timer wheel tick, and the main
+ * loop and the interrupt handler are timed on the host. Every button press is
+ * held for 20 samples and bounces at both edges. The numbers are host
+ * nanoseconds and TSC ticks, not PIC cycles, so they are only meaningful
+ * relative to another run of the same bench on the same machine. The one
+ * exception is "delay Tcy": the worst number of virtual instruction cycles
+ * a single call spent in __delay_ms, during which the real part does
+ * nothing else.
+ *
+ * Usage: bench [-n iterations] [-p passes] [-d] trace
+ *        bench -c [-n iterations] trace
+ *   -n  replay the trace this many times (default 200)
+ *   -p  main-loop passes run after every input edge and tick (default 2)
+ *   -d  write the LED columns, piece count and the digits shown on the
+ *       7-segment display after every period to stdout
+ *   -c  time the board operations instead, 1000 calls of each in every
+ *       state the trace goes through
+ */
+
+#include "firmware.h"
+#include "mock_sfr.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+/* **** Trace **** */
+/*
+ * One line per blink period, listing the buttons pressed during it:
+ *   r l u d  right, left, up and down on RG0, RG4, RG2 and RG3
+ *   t s      rotate and submit on RB6 and RB7
+ *   .        nothing
+ *   *N       repeat the line N times
+ */
+typedef struct {
+    uint32_t offset; // first press in presses
+    uint32_t len;
+} period_t;
+
+static period_t* periods;
+static size_t n_periods;
+static char* presses;
+static size_t n_presses;
+
+static void* grow(void* p, size_t* cap, size_t need, size_t elem)
+{
+    if (need <= *cap)
+    {
+        return p;
+    }
+    *cap = need * 2;
+    p = realloc(p, *cap * elem);
+    if (!p)
+    {
+        perror("realloc");
+        exit(1);
+    }
+    return p;
+}
+
+static void add_period(period_t p)
+{
+    static size_t cap;
+    periods = grow(periods, &cap, n_periods + 1, sizeof(period_t));
+    periods[n_periods++] = p;
+}
+
+static void add_press(char c)
+{
+    static size_t cap;
+    presses = grow(presses, &cap, n_presses + 1, 1);
+    presses[n_presses++] = c;
+}
+
+static void load_trace(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    char line[1024];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        lineno++;
+        char* tok = strtok(line, " \t\r\n");
+        if (!tok || tok[0] == ';')
+        {
+            continue;
+        }
+
+        size_t start = n_presses;
+        unsigned repeat = 1;
+        for (; tok; tok = strtok(NULL, " \t\r\n"))
+        {
+            if (tok[0] == '*')
+            {
+                repeat = (unsigned) strtoul(tok + 1, NULL, 10);
+                continue;
+            }
+            for (char* c = tok; *c; ++c)
+            {
+                if (!strchr("rludts.", *c))
+                {
+                    fprintf(stderr, "%s:%d: unknown button %c\n", path, lineno, *c);
+                    exit(1);
+                }
+                if (*c != '.')
+                {
+                    add_press(*c);
+                }
+            }
+        }
+        for (unsigned i = 0; i < repeat; ++i)
+        {
+            period_t p = {(uint32_t) start, (uint32_t) (n_presses - start)};
+            add_period(p);
+        }
+    }
+    fclose(f);
+}
+
+/* **** Timing **** */
+static inline uint64_t now_ticks(void)
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+static double ns_per_tick = 1.0;
+
+static void calibrate(void)
+{
+#ifdef HAVE_TSC
+    struct timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    uint64_t t0 = now_ticks();
+    do
+    {
+        clock_gettime(CLOCK_MONOTONIC, &b);
+    } while ((b.tv_sec - a.tv_sec) * 1000000000L + (b.tv_nsec - a.tv_nsec) < 50000000L);
+    uint64_t t1 = now_ticks();
+    double ns = (double) (b.tv_sec - a.tv_sec) * 1e9 + (double) (b.tv_nsec - a.tv_nsec);
+    ns_per_tick = ns / (double) (t1 - t0);
+#endif
+}
+
+typedef enum {
+    ST_UPDATE,
+    ST_RENDER,
+    ST_WHEEL_ISR,
+    ST_COUNT
+} stat_id_t;
+
+static const char* stat_names[ST_COUNT] = {
+    "Update", "Render", "wheel isr",
+};
+
+typedef struct {
+    uint64_t calls;
+    uint64_t total;
+    uint64_t max;
+    uint64_t delay_max; // virtual cycles spent in __delay_ms in one call
+} stat_t;
+
+static stat_t stats[ST_COUNT];
+
+static inline void account(stat_id_t id, uint64_t t0, uint64_t t1, uint64_t delay)
+{
+    uint64_t d = t1 - t0;
+    stats[id].calls++;
+    stats[id].total += d;
+    if (d > stats[id].max)
+    {
+        stats[id].max = d;
+    }
+    if (delay > stats[id].delay_max)
+    {
+        stats[id].delay_max = delay;
+    }
+}
+
+#define TIMED(id, call)                                                \
+    do                                                                 \
+    {                                                                  \
+        uint64_t c0 = mock_cycles;                                     \
+        uint64_t t0 = now_ticks();                                     \
+        call;                                                          \
+        account((id), t0, now_ticks(), mock_cycles - c0);              \
+    } while (0)
+
+/* **** Replay **** */
+/* Main-loop passes, and those that had nothing to render */
+static uint64_t main_passes;
+static uint64_t idle_passes;
+
+static void main_pass(unsigned passes)
+{
+    for (unsigned p = 0; p < passes; ++p)
+    {
+        unsigned char cols;
+        main_passes++;
+        TIMED(ST_UPDATE, cols = Update());
+        if (cols)
+        {
+            TIMED(ST_RENDER, Render(cols));
+        }
+        else
+        {
+            idle_passes++;
+        }
+    }
+}
+
+static void isr(stat_id_t id)
+{
+    if (INTCONbits.GIE)
+    {
+        TIMED(id, HandleInterrupt());
+    }
+}
+
+static uint8_t button_bit(char c)
+{
+    switch (c)
+    {
+    case 'r':
+        return 1 << 0;
+    case 'u':
+        return 1 << 2;
+    case 'd':
+        return 1 << 3;
+    case 'l':
+        return 1 << 4;
+    case 't':
+        return 1 << 6;
+    default:
+        return 1 << 7;
+    }
+}
+
+/* Timer2 interrupts in one blink period */
+#define SCANS_PER_PERIOD 250
+
+/*
+ * A button level is held for HOLD_SCANS Timer2 interrupts. For the first
+ * BOUNCE_SCANS of them the contacts bounce and every other sample reads
+ * the old level.
+ */
+#define HOLD_SCANS   20
+#define BOUNCE_SCANS 3
+
+/* Segments last seen on each digit, by PORTH select bit */
+static uint8_t shown[4];
+
+/* Timer2 interrupts so far in this period */
+static unsigned scans;
+
+static void scan(void)
+{
+    scans++;
+    if (PIE1bits.TMR2IE && INTCONbits.PEIE)
+    {
+        PIR1bits.TMR2IF = 1;
+        isr(ST_WHEEL_ISR);
+        for (int d = 0; d < 4; ++d)
+        {
+            if (PORTH == 1u << d)
+            {
+                shown[d] = PORTJ;
+            }
+        }
+    }
+}
+
+/* Presses and releases one button, running the main loop after each edge */
+static void press(char c, unsigned passes)
+{
+    uint8_t mask = button_bit(c);
+    volatile uint8_t* port = (c == 't' || c == 's') ? &PORTB : &PORTG;
+    for (int level = 1; level >= 0; --level)
+    {
+        for (unsigned i = 0; i < HOLD_SCANS; ++i)
+        {
+            int now = (i < BOUNCE_SCANS && (i & 1)) ? !level : level;
+            *port = now ? *port | mask : *port & ~mask;
+            scan();
+        }
+        main_pass(passes);
+    }
+}
+
+/* The digit a segment pattern shows, '?' for none */
+static char digit_of(uint8_t segments)
+{
+    static const uint8_t lookup[10] = {0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F};
+    for (int i = 0; i < 10; ++i)
+    {
+        if (lookup[i] == segments)
+        {
+            return (char) ('0' + i);
+        }
+    }
+    return '?';
+}
+
+static void tick(unsigned passes)
+{
+    while (scans < SCANS_PER_PERIOD)
+    {
+        scan();
+    }
+    scans = 0;
+    main_pass(passes);
+}
+
+static void boot(void)
+{
+    memset(shown, 0, sizeof(shown));
+    scans = 0;
+    mock_reset();
+    InitBoard();
+    InitTimers();
+    InitInterrupts();
+}
+
+static void replay(unsigned passes, int dump)
+{
+    for (size_t i = 0; i < n_periods; ++i)
+    {
+        const period_t* p = &periods[i];
+        for (uint32_t k = 0; k < p->len; ++k)
+        {
+            press(presses[p->offset + k], passes);
+        }
+        tick(passes);
+        if (dump)
+        {
+            printf("%02x %02x %02x %02x %d %c%c%c%c\n", LATC, LATD, LATE, LATF, pieces, digit_of(shown[0]),
+                   digit_of(shown[1]), digit_of(shown[2]), digit_of(shown[3]));
+        }
+    }
+}
+
+/* **** Board operation microbenchmark **** */
+/*
+ * Replays the trace once and, in the state reached after every period,
+ * calls each board operation OPS_REPS times in a row. The calls go through
+ * the linker, so every one of them runs. UpdateBuffer is timed with every
+ * column dirty, the most it can have to do.
+ */
+#define OPS_REPS 1000
+
+typedef enum {
+    OP_IN_BOUNDS,
+    OP_COLLIDING,
+    OP_SUBMITABLE,
+    OP_UPDATE_BUFFER,
+    OP_COUNT
+} op_id_t;
+
+static const char* op_names[OP_COUNT] = {
+    "ShapeInBounds", "IsColliding", "IsSubmitable", "UpdateBuffer",
+};
+
+static uint64_t op_total[OP_COUNT];
+static uint64_t op_calls[OP_COUNT];
+
+static void time_ops(void)
+{
+    uint64_t t0 = now_ticks();
+    for (unsigned r = 0; r < OPS_REPS; ++r)
+    {
+        ShapeInBounds(1, 0);
+        ShapeInBounds(0, 0);
+        ShapeInBounds(0, 1);
+        ShapeInBounds(1, 1);
+    }
+    uint64_t t1 = now_ticks();
+    for (unsigned r = 0; r < OPS_REPS; ++r)
+    {
+        IsColliding(1, 0);
+        IsColliding(0, 0);
+        IsColliding(0, 1);
+        IsColliding(1, 1);
+    }
+    uint64_t t2 = now_ticks();
+    for (unsigned r = 0; r < OPS_REPS; ++r)
+    {
+        IsSubmitable();
+    }
+    uint64_t t3 = now_ticks();
+    for (unsigned r = 0; r < OPS_REPS; ++r)
+    {
+        dirty = ALL_COLUMNS;
+        UpdateBuffer();
+    }
+    uint64_t t4 = now_ticks();
+
+    op_total[OP_IN_BOUNDS] += t1 - t0;
+    op_calls[OP_IN_BOUNDS] += 4 * OPS_REPS;
+    op_total[OP_COLLIDING] += t2 - t1;
+    op_calls[OP_COLLIDING] += 4 * OPS_REPS;
+    op_total[OP_SUBMITABLE] += t3 - t2;
+    op_calls[OP_SUBMITABLE] += OPS_REPS;
+    op_total[OP_UPDATE_BUFFER] += t4 - t3;
+    op_calls[OP_UPDATE_BUFFER] += OPS_REPS;
+}
+
+static void ops_bench(unsigned iterations, unsigned passes)
+{
+    for (unsigned it = 0; it < iterations; ++it)
+    {
+        boot();
+        for (size_t i = 0; i < n_periods; ++i)
+        {
+            const period_t* p = &periods[i];
+            for (uint32_t k = 0; k < p->len; ++k)
+            {
+                press(presses[p->offset + k], passes);
+            }
+            tick(passes);
+            time_ops();
+        }
+    }
+    printf("%-14s %12s %10s %12s\n", "operation", "calls", "ns/call", "ticks/call");
+    for (int i = 0; i < OP_COUNT; ++i)
+    {
+        printf("%-14s %12llu %10.2f %12.2f\n", op_names[i], (unsigned long long) op_calls[i],
+               (double) op_total[i] * ns_per_tick / (double) op_calls[i], (double) op_total[i] / (double) op_calls[i]);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned iterations = 200;
+    unsigned passes = 2;
+    int dump = 0;
+    int ops = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:dc")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            iterations = (unsigned) strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            passes = (unsigned) strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            dump = 1;
+            break;
+        case 'c':
+            ops = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-p passes] [-d | -c] trace\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1 || iterations == 0)
+    {
+        fprintf(stderr, "usage: %s [-n iterations] [-p passes] [-d | -c] trace\n", argv[0]);
+        return 2;
+    }
+
+    load_trace(argv[optind]);
+
+    if (dump)
+    {
+        boot();
+        replay(passes, 1);
+        return 0;
+    }
+
+    calibrate();
+    if (ops)
+    {
+        ops_bench(iterations, passes);
+        return 0;
+    }
+
+    struct timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    for (unsigned it = 0; it < iterations; ++it)
+    {
+        boot();
+        replay(passes, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    double wall = (double) (b.tv_sec - a.tv_sec) + (double) (b.tv_nsec - a.tv_nsec) * 1e-9;
+
+    printf("trace %s: %zu periods, %zu presses, %u iterations, %u passes/edge\n", argv[optind], n_periods, n_presses,
+           iterations, passes);
+    printf("%-14s %12s %12s %10s %10s %10s\n", "handler", "calls", "total ms", "mean ns", "max ns", "delay Tcy");
+    for (int i = 0; i < ST_COUNT; ++i)
+    {
+        const stat_t* s = &stats[i];
+        if (s->calls == 0)
+        {
+            continue;
+        }
+        printf("%-14s %12llu %12.3f %10.1f %10.1f %10llu\n", stat_names[i], (unsigned long long) s->calls,
+               (double) s->total * ns_per_tick * 1e-6, (double) s->total * ns_per_tick / (double) s->calls,
+               (double) s->max * ns_per_tick, (unsigned long long) s->delay_max);
+    }
+    printf("events dropped: %d\n", eventsDropped);
+    printf("main passes with nothing to render: %.1f%%\n",
+           main_passes ? 100.0 * (double) idle_passes / (double) main_passes : 0.0);
+    printf("throughput: %.0f periods/s (%.3f s wall)\n", (double) (n_periods * iterations) / wall, wall);
+    return 0;
+}
@@ -0,0 +1,25 @@
+/*
+ * File:   firmware.h
+ *
+ * Entry points of main.c that the host bench drives directly. main.c has
+ * no header of its own, so these mirror the definitions in ../main.c. The
+ * game rules it links with are declared in ../game.h.
+ */
+
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+#include "game.h"
+
+void InitBoard();
+void InitTimers();
+void InitInterrupts();
+
+unsigned char Update();
+void Render(unsigned char cols);
+
+void HandleInterrupt();
+
+extern volatile char eventsDropped;
+
+#endif /* FIRMWARE_H */
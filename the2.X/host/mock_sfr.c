@@ -0,0 +1,43 @@
+/*
+ * File:   mock_sfr.c
+ *
+ * Storage for the mock register file, see mock_sfr.h.
+ */
+
+#include "mock_sfr.h"
+
+volatile mock_INTCON_t mock_INTCON;
+volatile mock_INTCON2_t mock_INTCON2;
+volatile mock_RCON_t mock_RCON;
+volatile mock_PIR1_t mock_PIR1;
+volatile mock_PIE1_t mock_PIE1;
+volatile mock_T0CON_t mock_T0CON;
+
+volatile uint8_t PORTB, PORTG, PORTH, PORTJ;
+volatile uint8_t LATA, LATB, LATC, LATD, LATE, LATF, LATG, LATH;
+volatile uint8_t TRISA, TRISB, TRISC, TRISD, TRISE, TRISF, TRISG, TRISH, TRISJ;
+volatile uint8_t TMR0H, TMR0L;
+volatile uint8_t T1CON, TMR1H, TMR1L;
+volatile uint8_t T2CON, TMR2, PR2;
+volatile uint8_t ADCON1;
+
+uint64_t mock_cycles;
+
+void mock_reset(void)
+{
+    mock_INTCON.reg = 0x00;
+    mock_INTCON2.reg = 0xFF;
+    mock_RCON.reg = 0x1C;
+    mock_PIR1.reg = 0x00;
+    mock_PIE1.reg = 0x00;
+    mock_T0CON.reg = 0xFF;
+    PORTB = PORTG = PORTH = PORTJ = 0x00;
+    LATA = LATB = LATC = LATD = LATE = LATF = LATG = LATH = 0x00;
+    TRISA = TRISB = TRISC = TRISD = TRISE = TRISF = TRISG = TRISH = TRISJ = 0xFF;
+    TMR0H = TMR0L = 0x00;
+    T1CON = TMR1H = TMR1L = 0x00;
+    T2CON = TMR2 = 0x00;
+    PR2 = 0xFF;
+    ADCON1 = 0x00;
+    mock_cycles = 0;
+}
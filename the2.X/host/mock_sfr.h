@@ -0,0 +1,77 @@
+/*
+ * File:   mock_sfr.h
+ *
+ * Mock PIC18F8722 register file for the host build of THE2. Only the
+ * registers touched by the game are modelled. Byte registers are plain
+ * variables, bit-addressable ones are unions so that both FOO and FOObits
+ * work like on the real part.
+ *
+ * __delay_ms does not wait. It advances the virtual instruction-cycle
+ * clock, mock_cycles, by the cycles the real busy-wait would burn, so the
+ * bench can report how long the game blocks.
+ */
+
+#ifndef MOCK_SFR_H
+#define MOCK_SFR_H
+
+#include <stdint.h>
+
+/* XC8 keywords and intrinsics that have no meaning on the host */
+#define __interrupt(priority)
+#define NOP()
+#define __delay_ms(ms) (mock_cycles += (uint64_t) (ms) * (_XTAL_FREQ / 4000u))
+
+/* Declares a bit-addressable register NAME and its NAMEbits view */
+#define MOCK_SFR_BITS(name, fields)                                                                                                        \
+    typedef union                                                                                                                          \
+    {                                                                                                                                      \
+        uint8_t reg;                                                                                                                       \
+        struct                                                                                                                             \
+        {                                                                                                                                  \
+            fields                                                                                                                         \
+        };                                                                                                                                 \
+    } mock_##name##_t;                                                                                                                     \
+    extern volatile mock_##name##_t mock_##name
+
+MOCK_SFR_BITS(INTCON, unsigned RBIF : 1; unsigned INT0IF : 1; unsigned TMR0IF : 1; unsigned RBIE : 1; unsigned INT0IE : 1;
+              unsigned TMR0IE : 1; unsigned PEIE : 1; unsigned GIE : 1;);
+MOCK_SFR_BITS(INTCON2, unsigned RBIP : 1; unsigned INT3IP : 1; unsigned TMR0IP : 1; unsigned INTEDG3 : 1; unsigned INTEDG2 : 1;
+              unsigned INTEDG1 : 1; unsigned INTEDG0 : 1; unsigned NOT_RBPU : 1;);
+MOCK_SFR_BITS(RCON, unsigned NOT_BOR : 1; unsigned NOT_POR : 1; unsigned NOT_PD : 1; unsigned NOT_TO : 1; unsigned NOT_RI : 1;
+              unsigned : 1; unsigned SBOREN : 1; unsigned IPEN : 1;);
+MOCK_SFR_BITS(PIR1, unsigned TMR1IF : 1; unsigned TMR2IF : 1; unsigned CCP1IF : 1; unsigned SSP1IF : 1; unsigned TX1IF : 1;
+              unsigned RC1IF : 1; unsigned ADIF : 1; unsigned PSPIF : 1;);
+MOCK_SFR_BITS(PIE1, unsigned TMR1IE : 1; unsigned TMR2IE : 1; unsigned CCP1IE : 1; unsigned SSP1IE : 1; unsigned TX1IE : 1;
+              unsigned RC1IE : 1; unsigned ADIE : 1; unsigned PSPIE : 1;);
+MOCK_SFR_BITS(T0CON, unsigned T0PS0 : 1; unsigned T0PS1 : 1; unsigned T0PS2 : 1; unsigned PSA : 1; unsigned T0SE : 1;
+              unsigned T0CS : 1; unsigned T08BIT : 1; unsigned TMR0ON : 1;);
+
+#define INTCON      mock_INTCON.reg
+#define INTCONbits  mock_INTCON
+#define INTCON2     mock_INTCON2.reg
+#define INTCON2bits mock_INTCON2
+#define RCON        mock_RCON.reg
+#define RCONbits    mock_RCON
+#define PIR1        mock_PIR1.reg
+#define PIR1bits    mock_PIR1
+#define PIE1        mock_PIE1.reg
+#define PIE1bits    mock_PIE1
+#define T0CON       mock_T0CON.reg
+#define T0CONbits   mock_T0CON
+
+extern volatile uint8_t PORTB, PORTG, PORTH, PORTJ;
+extern volatile uint8_t LATA, LATB, LATC, LATD, LATE, LATF, LATG, LATH;
+extern volatile uint8_t TRISA, TRISB, TRISC, TRISD, TRISE, TRISF, TRISG, TRISH, TRISJ;
+extern volatile uint8_t TMR0H, TMR0L;
+extern volatile uint8_t T1CON, TMR1H, TMR1L;
+extern volatile uint8_t T2CON, TMR2, PR2;
+extern volatile uint8_t ADCON1;
+
+extern uint64_t mock_cycles;
+
+/* **** Bench side of the mock **** */
+
+/* Puts every register back to its power-on value */
+void mock_reset(void);
+
+#endif /* MOCK_SFR_H */
@@ -0,0 +1,369 @@
+/*
+ * File:   replay.c
+ *
+ * Headless runner for the THE2 game rules in ../game.c. Recorded input
+ * traces are fed straight to GameStep, with no registers, interrupts or
+ * delays in between, and the placed board and the score are compared with
+ * the ones the trace expects. Blink and gravity are scheduled the way the
+ * firmware's timer wheel does it: blink every BLINK_MS ticks, gravity
+ * GRAVITY_MS ticks after the last gravity step or submit. Every GameStep
+ * call counts as one step.
+ *
+ * Usage: replay [-n iterations] [-p] trace...
+ *        replay -f seed [-n steps]
+ *   -n  replay every trace this many times and report steps/s (default 1),
+ *       or take this many fuzz steps (default 10000000)
+ *   -p  print the board and score at every check line instead of
+ *       comparing them, in the trace's own syntax
+ *   -f  fuzz: random events from this seed, checking after every step that
+ *       the score matches the board and that UpdateBuffer shows exactly
+ *       the board and the piece
+ */
+
+#include "game.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* **** Trace **** */
+/*
+ * One entry per line, in tick (ms) order:
+ *   <tick> r|l|u|d|t|s     right, left, up, down, rotate or submit pressed
+ *   <tick> = <board> <n>   after everything up to tick, the placed cells
+ *                          are <board> (hex, bit x * BOARD_HEIGHT + y) and
+ *                          pieces is n
+ *   ; comment
+ */
+#define CHECK (-1)
+
+/* Hex digits of a board */
+#define BOARD_DIGITS (BOARD_WIDTH * BOARD_HEIGHT / 4)
+
+typedef struct {
+    uint32_t tick;
+    int ev; // GAME_ event or CHECK
+    uint64_t board;
+    int pieces;
+    int line;
+} entry_t;
+
+typedef struct {
+    const char* path;
+    entry_t* entries;
+    size_t n;
+} trace_t;
+
+static int event_of(char c)
+{
+    switch (c)
+    {
+    case 'r':
+        return GAME_RIGHT;
+    case 'l':
+        return GAME_LEFT;
+    case 'u':
+        return GAME_UP;
+    case 'd':
+        return GAME_DOWN;
+    case 't':
+        return GAME_ROTATE;
+    case 's':
+        return GAME_SUBMIT;
+    default:
+        return CHECK;
+    }
+}
+
+static void load_trace(trace_t* t, const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    size_t cap = 0;
+    char line[1024];
+    int lineno = 0;
+    uint32_t last = 0;
+    t->path = path;
+    t->entries = NULL;
+    t->n = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        lineno++;
+        char* tok = strtok(line, " \t\r\n");
+        if (!tok || tok[0] == ';')
+        {
+            continue;
+        }
+
+        entry_t e = {(uint32_t) strtoul(tok, NULL, 10), CHECK, 0, 0, lineno};
+        char* what = strtok(NULL, " \t\r\n");
+        if (!what || e.tick < last)
+        {
+            fprintf(stderr, "%s:%d: expected a tick, in order, and an event\n", path, lineno);
+            exit(1);
+        }
+        last = e.tick;
+        if (strcmp(what, "=") == 0)
+        {
+            char* b = strtok(NULL, " \t\r\n");
+            char* n = strtok(NULL, " \t\r\n");
+            if (!b || !n)
+            {
+                fprintf(stderr, "%s:%d: expected = <board> <pieces>\n", path, lineno);
+                exit(1);
+            }
+            e.board = strtoull(b, NULL, 16);
+            e.pieces = atoi(n);
+        }
+        else if (what[1] != '\0' || (e.ev = event_of(what[0])) == CHECK)
+        {
+            fprintf(stderr, "%s:%d: unknown event %s\n", path, lineno, what);
+            exit(1);
+        }
+
+        if (t->n == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            t->entries = realloc(t->entries, cap * sizeof(entry_t));
+            if (!t->entries)
+            {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        t->entries[t->n++] = e;
+    }
+    fclose(f);
+}
+
+/* **** Replay **** */
+static uint64_t steps;
+static uint32_t next_blink;
+static uint32_t next_gravity;
+
+static void start(void)
+{
+    GameInit();
+    next_blink = BLINK_MS;
+    next_gravity = GRAVITY_MS;
+}
+
+static void step(int ev, uint32_t now)
+{
+    steps++;
+    if (GameStep((char) ev) & GAME_SUBMITTED)
+    {
+        next_gravity = now + GRAVITY_MS;
+    }
+}
+
+/* Runs the blink and gravity timers that expire up to and including now */
+static void advance(uint32_t now)
+{
+    for (;;)
+    {
+        if (next_blink <= now && next_blink <= next_gravity)
+        {
+            step(GAME_BLINK, next_blink);
+            next_blink += BLINK_MS;
+        }
+        else if (next_gravity <= now)
+        {
+            step(GAME_GRAVITY, next_gravity);
+            next_gravity += GRAVITY_MS;
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+/* Returns the number of checks that failed */
+static int replay(const trace_t* t, int print)
+{
+    int failed = 0;
+    start();
+    for (size_t i = 0; i < t->n; ++i)
+    {
+        const entry_t* e = &t->entries[i];
+        advance(e->tick);
+        if (e->ev != CHECK)
+        {
+            step(e->ev, e->tick);
+        }
+        else if (print)
+        {
+            printf("%u = %0*llx %d\n", e->tick, BOARD_DIGITS, (unsigned long long) board.word, pieces);
+        }
+        else if ((uint64_t) board.word != e->board || pieces != e->pieces)
+        {
+            fprintf(stderr, "%s:%d: board %0*llx pieces %d, expected %0*llx %d\n", t->path, e->line, BOARD_DIGITS,
+                    (unsigned long long) board.word, pieces, BOARD_DIGITS, (unsigned long long) e->board,
+                    e->pieces);
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/* **** Fuzzing **** */
+/* Steps between two GameInit calls, long enough to fill the board */
+#define FUZZ_GAME_STEPS 4096
+
+static uint32_t rng;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static int popcount(uint64_t x)
+{
+    int n = 0;
+    for (; x; x &= x - 1)
+    {
+        n++;
+    }
+    return n;
+}
+
+/* Returns 0 and prints what is wrong if the game state is not consistent */
+static int consistent(void)
+{
+    static const int cells[3] = {1, 4, 3}; // DOT, SQUARE, L
+    uint64_t placed = board.word;
+    uint64_t piece = curTet.mask.word;
+
+    if (popcount(placed) != pieces)
+    {
+        fprintf(stderr, "pieces %d but %d cells placed\n", pieces, popcount(placed));
+        return 0;
+    }
+    if (curTet.type < 0 || curTet.type > 2 || popcount(piece) != cells[(int) curTet.type])
+    {
+        fprintf(stderr, "piece %d covers %0*llx\n", curTet.type, BOARD_DIGITS, (unsigned long long) piece);
+        return 0;
+    }
+    UpdateBuffer();
+    uint64_t shown = curTetDisplayed ? placed | piece : placed & ~piece;
+    if ((uint64_t) buffer.word != shown)
+    {
+        fprintf(stderr, "buffer %0*llx, board and piece give %0*llx\n", BOARD_DIGITS,
+                (unsigned long long) buffer.word, BOARD_DIGITS, (unsigned long long) shown);
+        return 0;
+    }
+    return 1;
+}
+
+static int fuzz(uint32_t seed, uint64_t n)
+{
+    static const int inputs[6] = {GAME_RIGHT, GAME_LEFT, GAME_UP, GAME_DOWN, GAME_ROTATE, GAME_SUBMIT};
+    uint32_t now = 0;
+    rng = seed ? seed : 1;
+    start();
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        if (i % FUZZ_GAME_STEPS == 0)
+        {
+            now = 0;
+            start();
+        }
+        now += next_random() % 300;
+        advance(now);
+        step(inputs[next_random() % 6], now);
+        if (!consistent())
+        {
+            fprintf(stderr, "seed %u, step %llu\n", seed, (unsigned long long) i);
+            return 1;
+        }
+    }
+    printf("fuzz seed %u: %llu steps consistent\n", seed, (unsigned long long) steps);
+    return 0;
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [-n iterations] [-p] trace...\n       %s -f seed [-n steps]\n", argv0, argv0);
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long long n = 0;
+    int print = 0;
+    int fuzzing = 0;
+    uint32_t seed = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:pf:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            n = strtoull(optarg, NULL, 10);
+            break;
+        case 'p':
+            print = 1;
+            break;
+        case 'f':
+            fuzzing = 1;
+            seed = (uint32_t) strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (fuzzing)
+    {
+        return fuzz(seed, n ? n : 10000000);
+    }
+    if (optind == argc)
+    {
+        usage(argv[0]);
+    }
+
+    int traces = argc - optind;
+    trace_t* t = calloc((size_t) traces, sizeof(trace_t));
+    for (int i = 0; i < traces; ++i)
+    {
+        load_trace(&t[i], argv[optind + i]);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < traces; ++i)
+    {
+        failed += replay(&t[i], print);
+    }
+    if (print || failed || n <= 1)
+    {
+        return failed != 0;
+    }
+
+    steps = 0;
+    struct timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    for (unsigned long long it = 0; it < n; ++it)
+    {
+        for (int i = 0; i < traces; ++i)
+        {
+            replay(&t[i], 0);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    double wall = (double) (b.tv_sec - a.tv_sec) + (double) (b.tv_nsec - a.tv_nsec) * 1e-9;
+    printf("%d traces, %llu iterations: %llu steps in %.3f s, %.2f M steps/s\n", traces, n,
+           (unsigned long long) steps, wall, (double) steps / wall * 1e-6);
+    return 0;
+}
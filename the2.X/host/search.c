@@ -0,0 +1,341 @@
+/*
+ * File:   search.c
+ *
+ * Placement search over the THE2 game rules in ../game.c. From a board and
+ * the piece to place, every state the piece can reach with the right,
+ * left, up, down and rotate events is found breadth first, by running the
+ * events through GameStep itself. The reachable states where IsSubmitable
+ * holds are the legal placements; submitting one through GameStep spawns
+ * the next piece of the DOT, SQUARE, L cycle.
+ *
+ * perft counts the placement sequences of a given length, like the chess
+ * move path enumeration test, and times them. autoplay picks the
+ * placement with the best outcome a number of pieces ahead and writes the
+ * game as a trace for replay, presses and checks included.
+ *
+ * Usage: search [-b board] [-t type] -p depth
+ *        search [-b board] [-t type] -a depth
+ *   -b  placed cells to start from, hex bitboard (default empty)
+ *   -t  piece to place first: 0 DOT, 1 SQUARE, 2 L (default 0)
+ *   -p  count the leaves of every depth up to this one, with nodes/s
+ *   -a  autoplay until no placement is left, looking this many pieces
+ *       ahead, and write the game to stdout in the replay trace syntax
+ */
+
+#include "game.h"
+#define PIECE_TABLES_NO_DATA // PIECE_COUNT and ORIENT_COUNT, the tables are in game.c
+#include "piece_tables.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* **** Placements **** */
+/* At least the positions of all orientations of one piece on the board */
+#define MAX_STATES (ORIENT_COUNT * BOARD_WIDTH * BOARD_HEIGHT)
+
+/* Hex digits of a board */
+#define BOARD_DIGITS (BOARD_WIDTH * BOARD_HEIGHT / 4)
+
+typedef struct {
+    Tetromino tet;
+    int16_t parent; // state it was reached from, -1 for the spawn
+    char press;     // GAME_ event that reached it
+} state_t;
+
+typedef struct {
+    Board board;
+    Tetromino tet;
+    char pieces;
+} snapshot_t;
+
+static const char moves[5] = {GAME_RIGHT, GAME_LEFT, GAME_UP, GAME_DOWN, GAME_ROTATE};
+
+/* seen[orient][x][y] == stamp: reached in the current search */
+static uint32_t seen[ORIENT_COUNT][BOARD_WIDTH][BOARD_HEIGHT];
+static uint32_t stamp;
+
+/* Every GameStep and IsSubmitable call the search makes */
+static uint64_t nodes;
+
+static void save(snapshot_t* s)
+{
+    s->board = board;
+    s->tet = curTet;
+    s->pieces = pieces;
+}
+
+static void load(const snapshot_t* s)
+{
+    board = s->board;
+    curTet = s->tet;
+    pieces = s->pieces;
+}
+
+static int visit(void)
+{
+    uint32_t* v = &seen[(int) curTet.orient][(int) curTet.x][(int) curTet.y];
+    if (*v == stamp)
+    {
+        return 0;
+    }
+    *v = stamp;
+    return 1;
+}
+
+/*
+ * Fills states with everything curTet can reach and legal with the indices
+ * of those that can be submitted. Returns the number of legal ones. curTet
+ * is left at an arbitrary reachable state.
+ */
+static int placements(state_t* states, int16_t* legal)
+{
+    int n = 1;
+    int n_legal = 0;
+
+    stamp++;
+    states[0].tet = curTet;
+    states[0].parent = -1;
+    states[0].press = 0;
+    visit();
+    for (int i = 0; i < n; ++i)
+    {
+        for (int m = 0; m < 5; ++m)
+        {
+            curTet = states[i].tet;
+            GameStep(moves[m]);
+            nodes++;
+            if (visit())
+            {
+                states[n].tet = curTet;
+                states[n].parent = (int16_t) i;
+                states[n].press = moves[m];
+                n++;
+            }
+        }
+        curTet = states[i].tet;
+        nodes++;
+        if (IsSubmitable())
+        {
+            legal[n_legal++] = (int16_t) i;
+        }
+    }
+    return n_legal;
+}
+
+/* Places the piece of a state and spawns the next one */
+static void submit(const state_t* s)
+{
+    curTet = s->tet;
+    GameStep(GAME_SUBMIT);
+    nodes++;
+}
+
+/* **** perft **** */
+static uint64_t perft(int depth)
+{
+    state_t states[MAX_STATES];
+    int16_t legal[MAX_STATES];
+    int n = placements(states, legal);
+
+    if (depth == 1)
+    {
+        return (uint64_t) n;
+    }
+
+    snapshot_t s;
+    uint64_t leaves = 0;
+    save(&s);
+    for (int i = 0; i < n; ++i)
+    {
+        submit(&states[legal[i]]);
+        leaves += perft(depth - 1);
+        load(&s);
+    }
+    return leaves;
+}
+
+static void run_perft(int max_depth)
+{
+    printf("%5s %14s %10s %14s %12s\n", "depth", "leaves", "ms", "nodes", "M nodes/s");
+    snapshot_t root;
+    save(&root);
+    for (int d = 1; d <= max_depth; ++d)
+    {
+        struct timespec a, b;
+        nodes = 0;
+        load(&root);
+        clock_gettime(CLOCK_MONOTONIC, &a);
+        uint64_t leaves = perft(d);
+        clock_gettime(CLOCK_MONOTONIC, &b);
+        double s = (double) (b.tv_sec - a.tv_sec) + (double) (b.tv_nsec - a.tv_nsec) * 1e-9;
+        printf("%5d %14llu %10.1f %14llu %12.2f\n", d, (unsigned long long) leaves, s * 1e3,
+               (unsigned long long) nodes, s > 0 ? (double) nodes / s * 1e-6 : 0.0);
+    }
+}
+
+/* **** autoplay **** */
+/*
+ * The score only grows by the cells of each piece, so the game is about
+ * placing as many pieces as possible before none fits. A line ahead is
+ * worth its pieces, then the number of places left for the piece after it.
+ */
+static int value(int depth)
+{
+    state_t states[MAX_STATES];
+    int16_t legal[MAX_STATES];
+    int n = placements(states, legal);
+
+    if (depth == 0 || n == 0)
+    {
+        return pieces * 64 + n;
+    }
+
+    snapshot_t s;
+    int best = -1;
+    save(&s);
+    for (int i = 0; i < n; ++i)
+    {
+        submit(&states[legal[i]]);
+        int v = value(depth - 1);
+        if (v > best)
+        {
+            best = v;
+        }
+        load(&s);
+    }
+    return best;
+}
+
+static char press_char(char ev)
+{
+    switch (ev)
+    {
+    case GAME_RIGHT:
+        return 'r';
+    case GAME_LEFT:
+        return 'l';
+    case GAME_UP:
+        return 'u';
+    case GAME_DOWN:
+        return 'd';
+    case GAME_ROTATE:
+        return 't';
+    default:
+        return 's';
+    }
+}
+
+/*
+ * Presses are 10 ms apart, a whole placement takes far less than
+ * GRAVITY_MS, so gravity never moves a piece on its way.
+ */
+#define PRESS_MS 10
+
+static void autoplay(int depth)
+{
+    uint32_t now = 0;
+    int placed = 0;
+
+    printf("; Autoplay looking %d pieces ahead, written by search -a %d\n", depth, depth);
+    for (;;)
+    {
+        state_t states[MAX_STATES];
+        int16_t legal[MAX_STATES];
+        int n = placements(states, legal);
+        if (n == 0)
+        {
+            break;
+        }
+
+        snapshot_t s;
+        int best = 0;
+        int best_value = -1;
+        save(&s);
+        for (int i = 0; i < n; ++i)
+        {
+            submit(&states[legal[i]]);
+            int v = value(depth - 1);
+            if (v > best_value)
+            {
+                best_value = v;
+                best = legal[i];
+            }
+            load(&s);
+        }
+
+        char path[MAX_STATES];
+        int len = 0;
+        for (int i = best; states[i].parent >= 0; i = states[i].parent)
+        {
+            path[len++] = press_char(states[i].press);
+        }
+        while (len > 0)
+        {
+            now += PRESS_MS;
+            printf("%u %c\n", now, path[--len]);
+        }
+        now += PRESS_MS;
+        submit(&states[best]);
+        placed++;
+        printf("%u s\n%u = %0*llx %d\n", now, now, BOARD_DIGITS, (unsigned long long) board.word, pieces);
+    }
+    printf("; %d pieces placed, score %d\n", placed, pieces);
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [-b board] [-t type] -p depth | -a depth\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long long start = 0;
+    int type = 0;
+    int perft_depth = 0;
+    int auto_depth = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:t:p:a:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            start = strtoull(optarg, NULL, 16);
+            break;
+        case 't':
+            type = atoi(optarg);
+            break;
+        case 'p':
+            perft_depth = atoi(optarg);
+            break;
+        case 'a':
+            auto_depth = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc || type < 0 || type >= PIECE_COUNT || (perft_depth > 0) == (auto_depth > 0))
+    {
+        usage(argv[0]);
+    }
+
+    GameInit();
+    board.word = (BoardWord) start;
+    pieces = (char) __builtin_popcountll(board.word);
+    NewPiece((char) type);
+
+    if (perft_depth > 0)
+    {
+        run_perft(perft_depth);
+    }
+    else
+    {
+        autoplay(auto_depth);
+    }
+    return 0;
+}
@@ -38,62 +38,38 @@
 //             End              //
 // ============================ //
 
-#include <xc.h>
+#include "hal.h"
+#include "game.h"
 
 // ============================ //
 //        DEFINITIONS           //
 // ============================ //
 
-#define TOP_LEFT     curTet.shape.b0
-#define TOP_RIGHT    curTet.shape.b1
-#define BOTTOM_LEFT  curTet.shape.b2
-#define BOTTOM_RIGHT curTet.shape.b3
+// Timer2 interrupts at 10 MHz / 16 / (124 + 1) / 5 = 1 kHz, one timer wheel tick each
+#define T2_CONFIG 0x26 // 1:5 postscaler, TMR2ON, 1:16 prescaler
+#define T2_PERIOD 124
 
-#define IS_OUTSIDE(x, y) (((x) < 0) || ((x) > 3) || ((y) > 7) || ((y) < 0))
+// Timer1 counts instruction cycles for the wheel's own cost
+#define T1_CONFIG 0x81 // RD16, 1:1 prescaler, Fosc/4, TMR1ON
 
-// TODO: Change to appropriate values
-#define T_PRESCALER    0x05
-#define T_PRELOAD_HIGH 0x67
-#define T_PRELOAD_LOW  0x69
-
-#define bit char
-
-#define DOT_PIECE 0
-#define SQUARE_PIECE 1
-#define L_PIECE 2
-
-typedef union
-{
-    char byte;
-    
-    struct
-    {
-        unsigned int r0: 1; //least significant bit
-        unsigned int r1: 1;
-        unsigned int r2: 1;
-        unsigned int r3: 1;
-        
-        unsigned int b3: 1;
-        unsigned int b2: 1;
-        unsigned int b1: 1; 
-        unsigned int b0: 1; //most significant bit
-    };
-} Shape;
-
-typedef struct
-{
-    char col0;
-    char col1;
-    char col2;
-    char col3;
-} Board;
-
-typedef struct
-{
-    char type;
-    char x, y; // position of top left corner
-    Shape shape;
-} Tetromino;
+/*
+ * Port of every board byte: X(column, byte, port) sends byte[byte] of the
+ * buffer to LAT of port. Only 4x8 fits the lab board. The larger sizes
+ * also take ports A, B, G and H, where the lab board has the buttons and
+ * the digit select, so they need a board with the LED matrix wired there.
+ */
+#if BOARD_WIDTH == 4 && BOARD_HEIGHT == 8
+#define COLUMN_PORTS(X) X(0, 0, C) X(1, 1, D) X(2, 2, E) X(3, 3, F)
+#elif BOARD_WIDTH == 8 && BOARD_HEIGHT == 8
+#define COLUMN_PORTS(X) X(0, 0, C) X(1, 1, D) X(2, 2, E) X(3, 3, F) \
+                        X(4, 4, A) X(5, 5, B) X(6, 6, G) X(7, 7, H)
+#elif BOARD_WIDTH == 4 && BOARD_HEIGHT == 16
+#define COLUMN_PORTS(X) X(0, 0, C) X(0, 1, D) X(1, 2, E) X(1, 3, F) \
+                        X(2, 4, A) X(2, 5, B) X(3, 6, G) X(3, 7, H)
+#endif
+
+#define INIT_COLUMN_PORT(x, i, port) LAT##port = 0x00; TRIS##port = 0x00;
+#define RENDER_BYTE(x, i, port) if (cols & (1 << (x))) LAT##port = buffer.byte[i];
 
 // Lookup table for the 7-segment display (0-9, common cathode)
 const char segmentLookup[10] = {
@@ -109,53 +85,119 @@ const char segmentLookup[10] = {
     0x6F  // 9
 };
 
-static const Tetromino DOT    = {.type = DOT_PIECE, .x = 0, .y = 0, .shape = { .byte = 0x80 }};
-static const Tetromino SQUARE = {.type = SQUARE_PIECE, .x = 0, .y = 0, .shape = { .byte = 0xF0 }};
-static const Tetromino L      = {.type = L_PIECE, .x = 0, .y = 0, .shape = { .byte = 0xE0 }};
+char prevA;
 
-Tetromino curTet;
-Board board;
-Board buffer;
+/*
+ * Two frames of segments, digit i is enabled by PORTH bit i. ScanDisplay
+ * only reads digitSegments[displayFront], SetDisplay fills the other one
+ * and then flips displayFront, a single byte write.
+ */
+char digitSegments[2][4];
+volatile char displayFront = 0;
+char scanDigit = 0;
 
-char pieces = 0;
-char counter = 0;
+/*
+ * Buttons, numbered by their bit in the debounced input byte: the PORTG
+ * directions and the PORTB rotate and submit inputs do not overlap. Each
+ * number is also the GAME_ event of the button.
+ */
+#define IN_RIGHT  GAME_RIGHT  // RG0
+#define IN_UP     GAME_UP     // RG2
+#define IN_DOWN   GAME_DOWN   // RG3
+#define IN_LEFT   GAME_LEFT   // RG4
+#define IN_ROTATE GAME_ROTATE // RB6
+#define IN_SUBMIT GAME_SUBMIT // RB7
+#define PORTG_INPUTS 0x1D
+#define PORTB_INPUTS 0xC0
+#define READ_INPUTS() ((PORTG & PORTG_INPUTS) | (PORTB & PORTB_INPUTS))
+
+// Samples (ms, wheel ticks) an input must read its new level in a row before it changes
+#ifndef DEBOUNCE_DIR_MS
+#define DEBOUNCE_DIR_MS    5
+#endif
+#ifndef DEBOUNCE_BUTTON_MS
+#define DEBOUNCE_BUTTON_MS 5
+#endif
+const char debounceWindow[8] = {
+    DEBOUNCE_DIR_MS, 0, DEBOUNCE_DIR_MS, DEBOUNCE_DIR_MS,
+    DEBOUNCE_DIR_MS, 0, DEBOUNCE_BUTTON_MS, DEBOUNCE_BUTTON_MS
+};
+char debounced;        // accepted level of every input
+char debounceCount[8]; // samples in a row that disagreed with it
 
-char prevA;
-char lastPortA;
-char lastPortB;
+/*
+ * GAME_ events posted by the ISR for the main loop, which owns all game
+ * state. A press is posted as its IN_ number. The ISR is the single
+ * producer (eventHead) and the main loop the single consumer (eventTail).
+ */
+#define EVENT_QUEUE_SIZE 8 // power of two
+volatile char events[EVENT_QUEUE_SIZE];
+volatile char eventHead = 0;
+volatile char eventTail = 0;
+volatile char eventsDropped = 0;
+
+/*
+ * Timer wheel, every periodic job runs from here. Each Timer2 interrupt
+ * advances wheelPos by one slot and only looks at the timers linked into
+ * that slot, so a tick costs the same however many timers are registered
+ * and however long their periods are. A timer rounds turns of the wheel
+ * away from expiring is passed over rounds times first. An expired timer
+ * is relinked period ticks ahead before its handler runs. The handlers run
+ * in interrupt context.
+ */
+#define WHEEL_SLOTS 16 // power of two
+#define MAX_TIMERS  4
+#define NO_TIMER    0xFF
 
-// 1 if displayed, 0 o.w.
-char curTetDisplayed = 1;
+#define TIMER_SCAN    0 // display multiplexing
+#define TIMER_SAMPLE  1 // input debouncing
+#define TIMER_BLINK   2
+#define TIMER_GRAVITY 3
+
+typedef struct
+{
+    void (*handler)();
+    unsigned int period;  // ticks
+    unsigned int rounds;  // wheel turns left before it expires
+    unsigned char slot;
+    unsigned char next;   // next timer in the same slot
+} WheelTimer;
+
+WheelTimer timers[MAX_TIMERS];
+unsigned char wheel[WHEEL_SLOTS]; // first timer of each slot
+unsigned char wheelPos = 0;
+
+// Bit id set: restart timer id from a full period on the next tick. Set
+// from the main loop with one bsf, cleared by the ISR.
+volatile unsigned char timerRestart = 0;
+#define TimerRestart(id) (timerRestart |= (1 << (id)))
+
+// Instruction cycles of the last tick and the longest one so far
+unsigned int wheelCycles = 0;
+unsigned int wheelCyclesMax = 0;
 
 void InitBoard();
 void InitTimers();
 void InitInterrupts();
 
-void Update();
-void Render();
-
-void SetBoard(char x, char y, char v, Board* board);
-char GetBoard(char x, char y, Board* board);
-
-void ListenPortA();
-void UpdateBoard();
-void UpdateBuffer();
+unsigned char Update();
+void Render(unsigned char cols);
 
-char BitwiseAnd(Shape shape1, Shape shape2);
-void GetQuartet(char x, char y, Shape *shape, Board* board);
-void GetQuartet2(char x, char y, Shape *shape);
-void SetQuartet(char x, char y, Shape *shape, Board* board);
+void PostEvent(char ev);
+void ProcessEvents();
 
-char IsColliding(bit dir0, bit dir1);
-// void Move(bit dir0, bit dir1);
-void RotateShape(Shape *shape);
-char ShapeInBounds(bit dir0, bit dir1);
-void Submit();
+void TimerStart(unsigned char id, unsigned int period, void (*handler)());
+void TimerLink(unsigned char id, unsigned int ticks);
+void TimerUnlink(unsigned char id);
+void WheelTick();
+unsigned int ReadTimer1();
 
-void HandleTimer();
-void HandlePortB();
+void BlinkTimer();
+void GravityTimer();
+void SampleInputs();
 
-void DisplayOn7Segment(const char num);
+void SetDisplay(const char num);
+void ScanDisplay();
 
 // ============================ //
 //          GLOBALS             //
@@ -175,43 +217,26 @@ void InitBoard()
     PORTG = 0x00;
     LATG = 0x00;
     TRISG = 0b00011101;
-    lastPortA = PORTG;
 
     // 5, 6th bits are inputs
     PORTB = 0x00;
     LATB = 0x00;
     TRISB = 0b11000000;
-    lastPortB = PORTB;
-
-    // Write to LAT, read from PORT
-    LATC = 0x00;
-    LATD = 0x00;
-    LATE = 0x00;
-    LATF = 0x00;
-
-    // All outputs
-    TRISC = 0x00;
-    TRISD = 0x00;
-    TRISE = 0x00;
-    TRISF = 0x00;
+
+    // Board columns, all outputs. Write to LAT, read from PORT
+    COLUMN_PORTS(INIT_COLUMN_PORT)
+
+    // 7-segment display, all outputs
     TRISJ = 0x00;
     TRISH = 0x00;
 
-    for (char i = 0; i < 8; i++)
-    {
-        for (char j = 0; j < 4; j++)
-        {
-            SetBoard(j, i, 0, &board);
-        }
-    }
-
-    // SetBoard(2, 3, 1);
-    curTet = DOT;
-    // RotateShape(&curTet.shape);
+    GameInit();
 
     // Set the initial state of 7-segment display all to 0
-    PORTJ = segmentLookup[0];
-    PORTH = 0x0F;
+    SetDisplay(0);
+
+    // A button held during reset is not a press
+    debounced = READ_INPUTS();
 
     // wait for 1 second
     __delay_ms(1000);
@@ -219,13 +244,20 @@ void InitBoard()
 
 void InitTimers()
 {
-    T0CON = 0x00;           // Reset Timer0
+    for (unsigned char i = 0; i < WHEEL_SLOTS; i++)
+    {
+        wheel[i] = NO_TIMER;
+    }
+    TimerStart(TIMER_SCAN, 1, ScanDisplay);
+    TimerStart(TIMER_SAMPLE, 1, SampleInputs);
+    TimerStart(TIMER_BLINK, BLINK_MS, BlinkTimer);
+    TimerStart(TIMER_GRAVITY, GRAVITY_MS, GravityTimer);
 
-    T0CON |= T_PRESCALER;   // Load prescaler
-    TMR0H = T_PRELOAD_HIGH; // Pre-load the value
-    TMR0L = T_PRELOAD_LOW;
+    T1CON = T1_CONFIG;
 
-    T0CONbits.TMR0ON = 1;   // Enable Timer0
+    PR2 = T2_PERIOD;        // Wheel tick
+    TMR2 = 0x00;
+    T2CON = T2_CONFIG;
 }
 
 void InitInterrupts()
@@ -236,11 +268,11 @@ void InitInterrupts()
 
     RCONbits.IPEN = 0;     // Disable interrupt priorities
 
-    INTCONbits.PEIE   = 0; // Disable peripheral interrupts
-    INTCONbits.TMR0IE = 1; // Enable TMR0 interrupts
-    INTCONbits.RBIE   = 1; // Enable RB Port interrupts
+    INTCONbits.PEIE   = 1; // Enable peripheral interrupts
+    PIR1bits.TMR2IF   = 0;
+    PIE1bits.TMR2IE   = 1; // Enable TMR2 interrupts
+    INTCONbits.RBIE   = 0; // RB6, RB7 are sampled by Timer2
     
-    INTCON2bits.TMR0IP = 1;
     INTCON2bits.RBIP = 1;
     
     INTCONbits.INT0IE = 1;
@@ -248,377 +280,203 @@ void InitInterrupts()
     INTCONbits.GIE    = 1; // Enable global interrupts
 }
 
-void Update()
+//Returns the columns Render has to write, 0 if nothing changed
+unsigned char Update()
 {
-    ListenPortA();
-    UpdateBoard();
-    UpdateBuffer();
+    ProcessEvents();
+    return UpdateBuffer();
 }
 
-void Render()
+void Render(unsigned char cols)
 {
-    LATC = buffer.col0;
-    LATD = buffer.col1;
-    LATE = buffer.col2;
-    LATF = buffer.col3;
-    DisplayOn7Segment(pieces);
+    COLUMN_PORTS(RENDER_BYTE)
 }
 
-void SetBoard(char x, char y, char v, Board* board)
-{
-    switch (x)
-    {
-        case 0:
-            board->col0 = v == 1 ? board->col0 | (v << y) : board->col0 & ~(1 << y);
-            break;
-        case 1:
-            board->col1 = v == 1 ? board->col1 | (v << y) : board->col1 & ~(1 << y);
-            break;
-        case 2:
-            board->col2 = v == 1 ? board->col2 | (v << y) : board->col2 & ~(1 << y);
-            break;
-        case 3:
-            board->col3 = v == 1 ? board->col3 | (v << y) : board->col3 & ~(1 << y);
-            break;
-    };
-}
-
-char GetBoard(char x, char y, Board *board)
-{
-    char col;
-    switch (x)
-    {
-        case 0:
-            col = board->col0;
-            break;
-        case 1:
-            col = board->col1;
-            break;
-        case 2:
-            col = board->col2;
-            break;
-        case 3:
-            col = board->col3;
-            break;
-    }
-    
-    return ((col >> y) & 0x01);
-}
+// ============================ //
+//   INTERRUPT SERVICE ROUTINE  //
+// ============================ //
 
-void ListenPortA()
+__interrupt(high_priority)
+void HandleInterrupt()
 {
-    // Read the current state of Port A
-    char currentPortA = PORTG;
-    // Determine which bits have changed
-    char changedBits = currentPortA ^ lastPortA;
-
-    // Specifically check for changes in bits 0, 1, 2, 3
-    char x = curTet.x;
-    char y = curTet.y;
-    if (changedBits & (1 << 0)) // right
-    {
-        if (currentPortA & (1 << 0))
-        {
-            if(ShapeInBounds(1, 0))
-            {
-                curTet.x++;
-            }
-        }
-    }
-
-    if (changedBits & (1 << 2)) // up
-    {
-        if (currentPortA & (1 << 2))
-        {
-            if(ShapeInBounds(1, 1))
-            {
-                curTet.y--;
-            }
-        }
-    }
-
-    if (changedBits & (1 << 3)) // down
+    if (PIR1bits.TMR2IF)
     {
-        if (currentPortA & (1 << 3))
-        {
-            if(ShapeInBounds(0, 1))
-            {
-                curTet.y++;
-            }
-        }
+        PIR1bits.TMR2IF = 0;
+        WheelTick();
     }
 
-    if (changedBits & (1 << 4)) // left
+    if (INTCONbits.INT0IF)
     {
-        if (currentPortA & (1 << 4))
-        {
-            if(ShapeInBounds(0, 0))
-            {
-                curTet.x--;
-            }
-        }
+        INTCONbits.INT0IF = 0;
     }
-
-    // Update last known state of Port A
-    lastPortA = currentPortA;
-}
-
-/*
- * Bitwise ORed, since if board value is 1 and 
- * tetromino's value is 0 at the same position, it should not set board to 0
- */
-void UpdateBoard()
-{   
-    INTCONbits.TMR0IE = 0;
-    Shape bq;
-//    GetQuartet(curTet.x, curTet.y, &bq);
-//    bq.byte |= curTet.shape.byte;
-//    
-//    SetQuartet(curTet.x, curTet.y, &bq);
-    INTCONbits.TMR0IE = 1;
 }
 
-void UpdateBuffer()
+//Called from the ISRs only
+void PostEvent(char ev)
 {
-    INTCONbits.TMR0IE = 0;
-    buffer = board;
+    char next = (eventHead + 1) & (EVENT_QUEUE_SIZE - 1);
 
-    Shape bq;
-    if (curTetDisplayed)
-    {
-        GetQuartet(curTet.x, curTet.y, &bq, &buffer);
-        bq.byte |= curTet.shape.byte;
-        SetQuartet(curTet.x, curTet.y, &bq, &buffer);
-    }
-    else
+    if (next == eventTail)
     {
-        Shape tempShape = curTet.shape;
-        tempShape.byte = ~tempShape.byte;
-        tempShape.byte &= 0xF0;
-        GetQuartet(curTet.x, curTet.y, &bq, &buffer);
-        bq.byte &= tempShape.byte;
-        SetQuartet(curTet.x, curTet.y, &bq, &buffer);
+        eventsDropped++;
+        return;
     }
-
-    INTCONbits.TMR0IE = 1;
+    events[eventHead] = ev;
+    eventHead = next;
 }
 
-//returns true if at least one bit is overlapping
-char BitwiseAnd(Shape shape1, Shape shape2)
+void ProcessEvents()
 {
-    return ((shape1.byte & shape2.byte) != 0);
-}
-
-//From board
-void GetQuartet(char x, char y, Shape *shape, Board* board)
-{
-    shape->b0 = IS_OUTSIDE(x, y) ? 1 : GetBoard(x, y, board);
-    shape->b1 = IS_OUTSIDE(x + 1, y) ? 1 : GetBoard(x + 1, y, board);
-    shape->b2 = IS_OUTSIDE(x + 1, y + 1) ? 1 : GetBoard(x + 1, y + 1, board);
-    shape->b3 = IS_OUTSIDE(x, y + 1) ? 1 : GetBoard(x, y + 1, board);
-}
+    while (eventTail != eventHead)
+    {
+        char ev = events[eventTail];
+        eventTail = (eventTail + 1) & (EVENT_QUEUE_SIZE - 1);
 
-void GetQuartet2(char x, char y, Shape *shape)
-{
-    shape->b0 = IS_OUTSIDE(x, y) ? 1 : 0;
-    shape->b1 = IS_OUTSIDE(x + 1, y) ? 1 : 0;
-    shape->b2 = IS_OUTSIDE(x + 1, y + 1) ? 1 : 0;
-    shape->b3 = IS_OUTSIDE(x, y + 1) ? 1 : 0;
+        if (GameStep(ev) & GAME_SUBMITTED)
+        {
+            TimerRestart(TIMER_GRAVITY);
+            SetDisplay(pieces);
+        }
+    }
 }
 
-//Set board
-void SetQuartet(char x, char y, Shape *shape, Board* board)
+//Registers a timer that first expires period ticks from now
+void TimerStart(unsigned char id, unsigned int period, void (*handler)())
 {
-    SetBoard(x, y, (char) shape->b0, board);
-    SetBoard(x + 1, y, (char) shape->b1, board);
-    SetBoard(x + 1, y + 1, (char) shape->b2, board);
-    SetBoard(x, y + 1, (char) shape->b3, board);
+    timers[id].handler = handler;
+    timers[id].period = period;
+    TimerLink(id, period);
 }
 
-/*
- * dir0, dir1: 1, 0 > +x direction
- * dir0, dir1: 0, 0 > -x direction
- * dir0, dir1: 0, 1 > +y direction
- * dir0, dir1: 1, 1 > -y direction
- */
-char IsColliding(bit dir0, bit dir1)
+//Links a timer into the slot ticks (>= 1) ahead of the current one
+void TimerLink(unsigned char id, unsigned int ticks)
 {
-    Shape shape, curQuartet;
-    
-    GetQuartet(curTet.x, curTet.y, &curQuartet, &board);
-    curQuartet.byte ^= curTet.shape.byte;
-    SetQuartet(curTet.x, curTet.y, &curQuartet, &board);
-
-    GetQuartet((dir1 == 0) ? ( dir0 == 0 ? curTet.x - 1 : curTet.x + 1) : curTet.x, 
-               (dir1 == 1) ? ( dir0 == 0 ? curTet.y + 1 : curTet.y - 1) : curTet.y,
-               &shape,
-               &board); //black magic
-    
-    char returnVal = BitwiseAnd(shape, curTet.shape);
-    
-    GetQuartet(curTet.x, curTet.y, &curQuartet, &board);
-    curQuartet.byte |= curTet.shape.byte;
-    SetQuartet(curTet.x, curTet.y, &curQuartet, &board);
+    unsigned char slot = (wheelPos + ticks) & (WHEEL_SLOTS - 1);
 
-    return returnVal;
+    timers[id].rounds = (ticks - 1) / WHEEL_SLOTS;
+    timers[id].slot = slot;
+    timers[id].next = wheel[slot];
+    wheel[slot] = id;
 }
 
-char IsSubmitable()
+void TimerUnlink(unsigned char id)
 {
-    Shape shape;
+    unsigned char *link = &wheel[timers[id].slot];
 
-    GetQuartet(curTet.x, curTet.y, &shape, &board); //black magic
-    
-    return !BitwiseAnd(shape, curTet.shape);
+    while (*link != id)
+    {
+        link = &timers[*link].next;
+    }
+    *link = timers[id].next;
 }
 
-char ShapeInBounds(bit dir0, bit dir1)
+void WheelTick()
 {
-    Shape shape;
+    unsigned int t0 = ReadTimer1();
 
-    GetQuartet2((dir1 == 0) ? ( dir0 == 0 ? curTet.x - 1 : curTet.x + 1) : curTet.x, 
-               (dir1 == 1) ? ( dir0 == 0 ? curTet.y + 1 : curTet.y - 1) : curTet.y,
-               &shape); //black magic
+    if (timerRestart)
+    {
+        unsigned char mask = 0x01;
+        for (unsigned char i = 0; i < MAX_TIMERS; i++, mask <<= 1)
+        {
+            if (timerRestart & mask)
+            {
+                TimerUnlink(i);
+                TimerLink(i, timers[i].period);
+            }
+        }
+        timerRestart = 0;
+    }
 
-    return !BitwiseAnd(shape, curTet.shape);
-}
+    wheelPos = (wheelPos + 1) & (WHEEL_SLOTS - 1);
+    unsigned char id = wheel[wheelPos];
+    wheel[wheelPos] = NO_TIMER; // every timer in it is relinked below
 
-void Submit()
-{
-    if (IsSubmitable())
+    while (id != NO_TIMER)
     {
-        buffer = board; 
-        Shape bq;
-        GetQuartet(curTet.x, curTet.y, &bq, &buffer);
-        bq.byte |= curTet.shape.byte;
-        SetQuartet(curTet.x, curTet.y, &bq, &buffer);
-
-        board = buffer;
-        
-        
-        switch (curTet.type)
+        unsigned char next = timers[id].next;
+
+        if (timers[id].rounds == 0)
         {
-            case DOT_PIECE:
-                pieces++;
-                curTet = SQUARE;
-                break;
-            case SQUARE_PIECE:
-                pieces += 4;
-                curTet = L;
-                break;
-            case L_PIECE:
-                pieces += 3;
-                curTet = DOT;
-                break;
+            TimerLink(id, timers[id].period);
+            timers[id].handler();
         }
-        counter = 0;
-        curTetDisplayed = 0x01;
+        else
+        {
+            timers[id].rounds--;
+            timers[id].next = wheel[wheelPos];
+            wheel[wheelPos] = id;
+        }
+        id = next;
     }
-    
-}
 
-/*
-void Move(bit dir0, bit dir1)
-{
-    Shape curQuartet;
-    GetQuartet(curTet.x, curTet.y, &curQuartet);
-    
-    //clear current position of tetromino
-    curQuartet.byte ^= curTet.shape.byte;
-    SetQuartet(curTet.x, curTet.y, &curQuartet);
-    
-    curTet.x = (dir1 == 0) ? ( dir0 == 0 ? curTet.x - 1 : curTet.x + 1) : curTet.x;
-    curTet.y = (dir1 == 1) ? ( dir0 == 0 ? curTet.y + 1 : curTet.y - 1) : curTet.y;
-    
-    SetQuartet(curTet.x, curTet.y, &curTet.shape);
+    wheelCycles = ReadTimer1() - t0;
+    if (wheelCycles > wheelCyclesMax)
+    {
+        wheelCyclesMax = wheelCycles;
+    }
 }
-*/
 
-void RotateShape(Shape *shape)
+unsigned int ReadTimer1()
 {
-    shape->byte >>= 1;
-    shape->b0 = shape->r3;
-    shape->r3 = 0;
+    unsigned char lo = TMR1L; // Latches TMR1H, must be read first
+    return (unsigned int) ((TMR1H << 8) | lo);
 }
 
-// ============================ //
-//   INTERRUPT SERVICE ROUTINE  //
-// ============================ //
-
-__interrupt(high_priority)
-void HandleInterrupt()
+void BlinkTimer()
 {
-    if (INTCONbits.TMR0IF) 
-    {
-        INTCONbits.TMR0IF = 0; // Clear TMR0 interrupt flag
-        HandleTimer();
-        
-        
-        TMR0H = T_PRELOAD_HIGH; // Reset the value
-        TMR0L = T_PRELOAD_LOW;
-    }
-    else if (INTCONbits.RBIF)
-    {
-        HandlePortB();
-        INTCONbits.RBIF = 0; // Clear RB port interrupt flag
-    }
-    else if (INTCONbits.INT0IF)
-    {
-        INTCONbits.INT0IF = 0;
-    }
+    PostEvent(GAME_BLINK);
 }
 
-void HandleTimer()
-{   
-    if (++counter == 8)
-    {
-        if(ShapeInBounds(0, 1))
-        {
-            curTet.y++;
-        }
-        counter = 0;
-    }
-    
-    curTetDisplayed ^= 0x01;
+void GravityTimer()
+{
+    PostEvent(GAME_GRAVITY);
 }
 
-void HandlePortB()
+/*
+ * Debounces every input on one wheel tick. An input only changes its
+ * debounced level after reading the new level debounceWindow samples in a
+ * row, a press is posted once it has.
+ */
+void SampleInputs()
 {
-    __delay_ms(2);
-    char currentPortB = PORTB; // Read the current state of Port B
-    char changedBits = currentPortB ^ lastPortB; // Determine which bits have changed
+    char raw = READ_INPUTS();
+    char changed = raw ^ debounced;
+    unsigned char in = 0x01;
 
-    // Specifically check for changes in bits 5 and 6
-    if (changedBits & (1 << 6)) // RB5 = rotate
+    for (unsigned char i = 0; i < 8; i++, in <<= 1)
     {
-        if (currentPortB & (1 << 6))
+        if ((changed & in) == 0)
         {
-            if (curTet.type == L_PIECE)
-            {
-                RotateShape(&curTet.shape);
-            }
+            debounceCount[i] = 0;
         }
-    }
-
-    if (changedBits & (1 << 7)) // RB6 = submit
-    {
-        if (currentPortB & (1 << 7))
+        else if (++debounceCount[i] >= debounceWindow[i])
         {
-            Submit();
+            debounceCount[i] = 0;
+            debounced ^= in;
+            if (raw & in)
+            {
+                PostEvent(i);
+            }
         }
     }
-
-    lastPortB = currentPortB; // Update last known state of Port B
 }
 
-void DisplayOn7Segment(const char num)
+//Only updates the digits, ScanDisplay shows them from the next interrupt on
+void SetDisplay(const char num)
 {
-    char onesDigit;
-    char tensDigit;
+    char back = displayFront ^ 0x01;
 
-    onesDigit = num % 10;
-    tensDigit = num / 10;
+    digitSegments[back][3] = segmentLookup[num % 10];
+    digitSegments[back][2] = segmentLookup[num / 10];
+    digitSegments[back][1] = segmentLookup[0];
+    digitSegments[back][0] = segmentLookup[0];
 
+    displayFront = back;
+}
+
+void ScanDisplay()
+{
     // PORTH3 is connected to D0 on the 7-segment display
     // D0 is the rightmost 7-segment display. (Please check your board. This representation assumes I-O boards of the boards towards up)
 
@@ -626,27 +484,11 @@ void DisplayOn7Segment(const char num)
     // enable bit is one. For example, if only D0’s bit is enabled (PORTH3 is one), only D0 will
     // receive the PORTJ’s value.  
 
-    // Display the ones digit
-    PORTJ = segmentLookup[onesDigit];
-
-    // Enable the rightmost 7-segment display
-    PORTH = 0x08;
-    __delay_ms(1);
-
-    // Display the tens digit
-    PORTJ = segmentLookup[tensDigit];
+    PORTH = 0x00; // Blank while the segments change, no ghosting
+    PORTJ = digitSegments[displayFront][scanDigit];
+    PORTH = 1 << scanDigit;
 
-    // Enable the leftmost 7-segment display
-    PORTH = 0x04;
-    __delay_ms(1);
-
-    PORTJ = segmentLookup[0];
-
-    PORTH = 0x02;
-    __delay_ms(1);
-
-    PORTH = 0x01;
-    __delay_ms(1);
+    scanDigit = (scanDigit + 1) & 0x03;
 }
 
 // ============================ //
@@ -660,7 +502,10 @@ void main()
 
     while (1) 
     {
-        Update();
-        Render();
+        unsigned char cols = Update();
+        if (cols)
+        {
+            Render(cols);
+        }
     }
 }